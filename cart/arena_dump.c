@@ -0,0 +1,418 @@
+#include "arena_memory.h"
+#include "virtual_machine.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <signal.h>
+
+/**
+    Dump format, read back by tools/ykes_heap.c:
+        "YKHD", u32 version
+        u32 kinds, each a u8 length and the kind's name
+        'R' u8 length, name, u64 id                   a root
+        'O' u64 id, u8 kind, u64 bytes, u32 n, n u64 ids  an object
+        'E'
+    Ids are block addresses, integers native-endian.
+*/
+typedef enum
+{
+    DUMP_STRING,
+    DUMP_ARRAY,
+    DUMP_STRINGS,
+    DUMP_TABLE,
+    DUMP_STACK,
+    DUMP_VECTOR,
+    DUMP_CLOSURE,
+    DUMP_FUNCTION,
+    DUMP_CLASS,
+    DUMP_INSTANCE,
+    DUMP_NATIVE,
+    DUMP_UPVAL,
+    DUMP_KINDS
+} DumpKind;
+
+typedef struct
+{
+    FILE *out;
+    Element *queue;
+    size_t head;
+    size_t tail;
+    size_t len;
+    Free **seen;
+    size_t seen_count;
+    size_t seen_cap;
+    Element *refs;
+    size_t ref_count;
+    size_t ref_len;
+    size_t bytes;
+} Dump;
+
+static const char *dump_kinds[DUMP_KINDS] = {
+    "string", "array", "strings", "table", "stack", "vector",
+    "closure", "function", "class", "instance", "native", "upval"};
+
+static DumpKind dump_kind(Element el)
+{
+    switch (el.type)
+    {
+    case ARENA:
+        switch (el.arena.type)
+        {
+        case ARENA_STRS:
+            return DUMP_STRINGS;
+        case ARENA_STR:
+        case ARENA_CSTR:
+        case ARENA_FUNC:
+        case ARENA_NATIVE:
+        case ARENA_VAR:
+            return DUMP_STRING;
+        default:
+            return DUMP_ARRAY;
+        }
+    case TABLE:
+        return DUMP_TABLE;
+    case STACK:
+        return DUMP_STACK;
+    case VECTOR:
+        return DUMP_VECTOR;
+    case CLOSURE:
+    case METHOD:
+        return DUMP_CLOSURE;
+    case FUNCTION:
+        return DUMP_FUNCTION;
+    case CLASS:
+        return DUMP_CLASS;
+    case INSTANCE:
+        return DUMP_INSTANCE;
+    case NATIVE:
+        return DUMP_NATIVE;
+    default:
+        return DUMP_UPVAL;
+    }
+}
+
+static void *dump_grow(void *items, size_t *len, size_t size)
+{
+    *len = GROW_CAPACITY(*len);
+    items = realloc(items, *len * size);
+
+    if (!items)
+    {
+        perror("Failed to reallocate heap dump.");
+        exit(1);
+    }
+    return items;
+}
+
+/* true the first time a block is seen */
+static bool dump_see(Dump *d, Free *block)
+{
+    if ((d->seen_count + 1) * INC > d->seen_cap)
+    {
+        Free **old = d->seen;
+        size_t cap = d->seen_cap;
+
+        d->seen_cap = cap ? cap * INC : CAPACITY;
+        d->seen = calloc(d->seen_cap, sizeof(Free *));
+
+        if (!d->seen)
+        {
+            perror("Failed to reallocate heap dump.");
+            exit(1);
+        }
+
+        d->seen_count = 0;
+        for (size_t i = 0; i < cap; i++)
+            if (old[i])
+                dump_see(d, old[i]);
+        free(old);
+    }
+
+    size_t h = hash_ptr((uintptr_t)block) & (d->seen_cap - 1);
+
+    for (; d->seen[h]; h = (h + 1) & (d->seen_cap - 1))
+        if (d->seen[h] == block)
+            return false;
+
+    d->seen[h] = block;
+    d->seen_count++;
+    return true;
+}
+
+static Free *dump_block(Element el)
+{
+    Free *block = obj_block(el);
+    return (block && block_page(block)) ? block : NULL;
+}
+
+static void dump_enqueue(Dump *d, Element el)
+{
+    Free *block = dump_block(el);
+
+    if (!block || !dump_see(d, block))
+        return;
+
+    if (d->tail + 1 > d->len)
+        d->queue = dump_grow(d->queue, &d->len, sizeof(Element));
+    d->queue[d->tail++] = el;
+}
+
+static void dump_ref(Dump *d, Element el)
+{
+    if (!dump_block(el))
+        return;
+
+    if (d->ref_count + 1 > d->ref_len)
+        d->refs = dump_grow(d->refs, &d->ref_len, sizeof(Element));
+    d->refs[d->ref_count++] = el;
+}
+
+/* a raw block folded into the bytes of the object that owns it */
+static void dump_extra(Dump *d, void *ptr)
+{
+    Free *block = NULL;
+
+    if (ptr && block_page(block = PTR(ptr)))
+        d->bytes += block->size;
+}
+
+static void dump_entry(Dump *d, Table *entry)
+{
+    if (entry->key.type != ARENA_NULL)
+        dump_ref(d, OBJ(entry->key));
+    dump_ref(d, entry->val);
+}
+
+/* the same edges blacken_object follows */
+static void dump_refs(Dump *d, Element el)
+{
+    switch (el.type)
+    {
+    case ARENA:
+        if (el.arena.type == ARENA_STRS)
+        {
+            char **slots = el.arena.listof.Strings;
+            size_t cap = (PTR(slots)->size - OFFSET) / sizeof(char *);
+
+            for (size_t i = 0; i < cap; i++)
+                if (slots[i])
+                    dump_ref(d, OBJ(arena_init(slots[i], strlen(slots[i]), ARENA_STR)));
+        }
+        break;
+    case TABLE:
+    {
+        Table *tab = el.table;
+        size_t cap = (PTR((tab - 1))->size - OFFSET) / sizeof(Table) - 1;
+        size_t len = (size_t)(tab - 1)->len;
+
+        for (size_t i = 0; i < len && i < cap; i++)
+        {
+            dump_entry(d, &tab[i]);
+
+            for (Table *e = tab[i].next; e; e = e->next)
+            {
+                dump_extra(d, e);
+                dump_entry(d, e);
+            }
+        }
+        break;
+    }
+    case VECTOR:
+    {
+        Arena *vec = el.arena_vector;
+        size_t cap = (PTR((vec - 1))->size - OFFSET) / sizeof(Arena) - 1;
+
+        for (size_t i = 0; i < (size_t)(vec - 1)->count && i < cap; i++)
+            dump_ref(d, OBJ(vec[i]));
+        break;
+    }
+    case STACK:
+    {
+        Stack *s = el.stack;
+        size_t cap = (PTR((s - 1))->size - OFFSET) / sizeof(Stack) - 1;
+        size_t len = (size_t)(s->top - s);
+
+        if (s->top < s || len < (size_t)s->count)
+            len = (size_t)s->count;
+
+        for (size_t i = 0; i < len && i < cap; i++)
+            dump_ref(d, s[i].as);
+        break;
+    }
+    case CLOSURE:
+    case METHOD:
+        dump_ref(d, FUNC(el.closure->func));
+
+        if (!el.closure->upvals)
+            break;
+
+        dump_extra(d, el.closure->upvals - 1);
+        for (int i = 0; i < el.closure->upval_count; i++)
+            dump_ref(d, UPVAL(el.closure->upvals[i]));
+        break;
+    case FUNCTION:
+        dump_ref(d, OBJ(el.function->name));
+        dump_extra(d, el.function->ch.cases.listof.Ints);
+        dump_extra(d, el.function->ch.op_codes.listof.Shorts);
+        dump_extra(d, el.function->ch.lines.listof.Ints);
+        dump_ref(d, STK(el.function->ch.constants));
+        break;
+    case CLASS:
+        dump_ref(d, OBJ(el.classc->name));
+        dump_ref(d, CLOSURE(el.classc->init));
+        dump_ref(d, TABLE(el.classc->closures));
+        break;
+    case INSTANCE:
+        dump_ref(d, CLASS(el.instance->classc));
+        dump_ref(d, TABLE(el.instance->fields));
+        break;
+    case NATIVE:
+        dump_ref(d, OBJ(el.native->obj));
+        break;
+    case UPVAL:
+        dump_ref(d, el.upval->closed);
+        dump_ref(d, UPVAL(el.upval->next));
+        break;
+    default:
+        break;
+    }
+}
+
+static void dump_u8(Dump *d, uint8_t v)
+{
+    fwrite(&v, sizeof(v), 1, d->out);
+}
+
+static void dump_u32(Dump *d, uint32_t v)
+{
+    fwrite(&v, sizeof(v), 1, d->out);
+}
+
+static void dump_u64(Dump *d, uint64_t v)
+{
+    fwrite(&v, sizeof(v), 1, d->out);
+}
+
+static void dump_name(Dump *d, const char *name)
+{
+    size_t len = strlen(name);
+
+    if (len > UINT8_MAX)
+        len = UINT8_MAX;
+    dump_u8(d, (uint8_t)len);
+    fwrite(name, 1, len, d->out);
+}
+
+static void dump_root(Dump *d, const char *name, Element el)
+{
+    Free *block = dump_block(el);
+
+    if (!block)
+        return;
+
+    dump_u8(d, 'R');
+    dump_name(d, name);
+    dump_u64(d, (uintptr_t)block);
+    dump_enqueue(d, el);
+}
+
+static void dump_roots(Dump *d)
+{
+    char name[32];
+
+    for (Element *v = machine.stack; v < machine.stack_top; v++)
+        dump_root(d, "<stack>", *v);
+    dump_root(d, "<call_stack>", STK(machine.call_stack));
+    dump_root(d, "<class_stack>", STK(machine.class_stack));
+    dump_root(d, "<native_calls>", STK(machine.native_calls));
+    dump_root(d, "<globals>", TABLE(machine.glob));
+
+    for (int i = 0; i < machine.frame_count; i++)
+    {
+        snprintf(name, sizeof(name), "<frame %d>", i);
+        dump_root(d, name, CLOSURE(machine.frames[i].closure));
+    }
+
+    for (Upval *up = machine.open_upvals; up; up = up->next)
+        dump_root(d, "<open upvalue>", UPVAL(up));
+
+    Element regs[] = {machine.e1, machine.e2, machine.e3, machine.e4, machine.e5,
+                      OBJ(machine.r1), OBJ(machine.r2), OBJ(machine.r3),
+                      OBJ(machine.r4), OBJ(machine.r5)};
+
+    for (size_t i = 0; i < sizeof(regs) / sizeof(regs[0]); i++)
+        dump_root(d, "<registers>", regs[i]);
+
+    Table *glob = machine.glob;
+    size_t cap = (PTR((glob - 1))->size - OFFSET) / sizeof(Table) - 1;
+    size_t len = (size_t)(glob - 1)->len;
+
+    for (size_t i = 0; i < len && i < cap; i++)
+        for (Table *e = &glob[i]; e; e = e->next)
+            if (e->key.type != ARENA_NULL && STR(e->key))
+                dump_root(d, STR(e->key), e->val);
+}
+
+bool heap_dump(const char *path)
+{
+    Dump d;
+    memset(&d, 0, sizeof(d));
+
+    if (!machine.glob || !(d.out = fopen(path, "wb")))
+        return false;
+
+    fwrite("YKHD", 1, 4, d.out);
+    dump_u32(&d, HEAP_DUMP_VERSION);
+    dump_u32(&d, DUMP_KINDS);
+    for (int i = 0; i < DUMP_KINDS; i++)
+        dump_name(&d, dump_kinds[i]);
+
+    dump_roots(&d);
+
+    while (d.head < d.tail)
+    {
+        Element el = d.queue[d.head++];
+        Free *block = obj_block(el);
+
+        d.ref_count = 0;
+        d.bytes = block->size;
+        dump_refs(&d, el);
+
+        dump_u8(&d, 'O');
+        dump_u64(&d, (uintptr_t)block);
+        dump_u8(&d, (uint8_t)dump_kind(el));
+        dump_u64(&d, d.bytes);
+        dump_u32(&d, (uint32_t)d.ref_count);
+
+        for (size_t i = 0; i < d.ref_count; i++)
+            dump_u64(&d, (uintptr_t)dump_block(d.refs[i]));
+
+        for (size_t i = 0; i < d.ref_count; i++)
+            dump_enqueue(&d, d.refs[i]);
+    }
+
+    dump_u8(&d, 'E');
+
+    bool ok = !ferror(d.out);
+    ok = (fclose(d.out) == 0) && ok;
+
+    free(d.queue);
+    free(d.seen);
+    free(d.refs);
+    return ok;
+}
+
+static void on_dump_signal(int sig)
+{
+    (void)sig;
+    machine.dump_request = 1;
+}
+
+void initialize_heap_dump(void)
+{
+    struct sigaction act;
+    memset(&act, 0, sizeof(act));
+    act.sa_handler = on_dump_signal;
+    act.sa_flags = SA_RESTART;
+    sigemptyset(&act.sa_mask);
+    sigaction(SIGUSR1, &act, NULL);
+}
@@ -1613,6 +1613,9 @@ ERR:
 }
 static void _set_string_index(Arena *String, Arena index, char Char)
 {
+    *String = spill_string(*String);
+    String->as.hash = 0;
+
     int count = String->as.count,
         len = String->as.len;
 
@@ -2098,7 +2101,7 @@ Arena _seq(Arena a, Arena b)
         return Bool(b.as.Char == a.as.Char);
     case ARENA_CSTR:
     case ARENA_STR:
-        return Bool(strcmp(b.as.String, a.as.String) == 0);
+        return Bool(string_same(&b, &a));
     case ARENA_NULL:
         return Bool(false);
     case ARENA_BOOL:
@@ -2126,7 +2129,7 @@ Arena _sne(Arena a, Arena b)
         return Bool(b.as.Char != a.as.Char);
     case ARENA_CSTR:
     case ARENA_STR:
-        return Bool(strcmp(b.as.String, a.as.String) != 0);
+        return Bool(!string_same(&b, &a));
     case ARENA_NULL:
         return Bool(false);
     case ARENA_BOOL:
@@ -2258,9 +2261,9 @@ Element _get_each_access(Element b, int index)
             return OBJ(Double(*(b.arena.listof.Doubles + index)));
         case ARENA_STR:
         case ARENA_CSTR:
-            if (index > b.arena.as.len - 1)
+            if (index > STR_LEN(b.arena) - 1)
                 return nil;
-            return OBJ(Char(*(b.arena.as.String + index)));
+            return OBJ(Char(*(STR(b.arena) + index)));
         case ARENA_STRS:
             if (index > b.arena.count - 1)
                 return nil;
@@ -2298,14 +2301,20 @@ Element _get_access(Arena a, Element b)
             return OBJ(_access_doubles(b.arena.listof.Doubles, a, b.arena.count));
         case ARENA_STR:
         case ARENA_CSTR:
-            return OBJ(_access_string(b.arena.as.String, a, b.arena.as.len));
+            return OBJ(_access_string(STR(b.arena), a, STR_LEN(b.arena)));
         case ARENA_STRS:
             return OBJ(_access_strings(b.arena.listof.Strings, a, b.arena.count));
         default:
             goto ERR;
         }
     case TABLE:
-        return find_entry(&b.table, &a);
+    {
+        Element el = find_entry(&b.table, &a);
+
+        if (flatten_str(&el))
+            write_table(b.table, a, el);
+        return el;
+    }
     case VECTOR:
         return OBJ(_access_arena(b.arena_vector, a, (b.arena_vector - 1)->count));
     case STACK:
@@ -2349,7 +2358,8 @@ void _set_access(Element val, Arena index, Element b)
         case ARENA_STRS:
             if (val.arena.type != ARENA_STR && val.arena.type != ARENA_CSTR)
                 goto ERR;
-            _set_strings_index(&ar, index, val.arena.as.String);
+            _set_strings_index(&ar, index, spill_string(val.arena).as.String);
+            WRITE_BARRIER(OBJ(ar));
             return;
         default:
             break;
@@ -2366,9 +2376,11 @@ void _set_access(Element val, Arena index, Element b)
         if (val.type != ARENA)
             goto ERR;
         _set_arena_index(&b.arena_vector, index, val.arena);
+        WRITE_BARRIER(b);
         break;
     case STACK:
         _set_stack_index(&b.stack, index, val);
+        WRITE_BARRIER(b);
         break;
     default:
     ERR:
@@ -2406,7 +2418,7 @@ Element _push_array_val(Element val, Element el)
         case ARENA_STRS:
             if (ar.type != ARENA_STR && ar.type != ARENA_CSTR)
                 goto ERR;
-            push_string(&el, ar.as.String);
+            push_string(&el, spill_string(ar).as.String);
             return el;
         default:
             goto ERR;
@@ -2475,7 +2487,7 @@ Arena _len(Element el)
             return Int(a.count);
         case ARENA_CSTR:
         case ARENA_STR:
-            return Int(a.as.len);
+            return Int(STR_LEN(a));
         default:
             return Int(0);
         }
@@ -2584,10 +2596,12 @@ Element reverse_el(Element el)
     case ARENA_STR:
     case ARENA_CSTR:
     {
-        char *from = el.arena.as.String;
-        char *to = el.arena.as.String + el.arena.size - 1;
+        el.arena = spill_string(el.arena);
+        char *from = STR(el.arena);
+        char *to = STR(el.arena) + el.arena.size - 1;
         for (; from < to; --to, ++from)
             char_swap(from, to);
+        el.arena.as.hash = 0;
         return el;
     }
     case ARENA_INTS:
@@ -1,3 +1,4 @@
+#define _GNU_SOURCE
 #include "arena_memory.h"
 #include "virtual_machine.h"
 #include "compiler.h"
@@ -6,748 +7,3039 @@
 #include <sys/mman.h>
 #include <sys/stat.h>
 #include <stdlib.h>
+#include <time.h>
+#include <pthread.h>
+#include <sched.h>
+#include <signal.h>
+#include <unistd.h>
 
-#ifdef DEBUG_LOG_GC
-#include "debug.h"
-#endif
-
-static void *request_system_memory(size_t size)
+/**
+    One PROT_NONE reservation, committed page by page off heap_top.
+    Blocks of LARGE_MIN or more get a mapping of their own instead.
+*/
+typedef struct
 {
-    void *ptr = NULL;
-    ptr = mmap(
+    char *addr;
+    size_t size;
+} Span;
+
+static char *heap_map;
+static char *heap_base;
+static char *heap_top;
+static char *heap_end;
+static size_t heap_committed;
+static Span *spare;
+static size_t spare_count;
+static size_t spare_len;
+
+static void reserve_heap(void)
+{
+    char *ptr = mmap(
         NULL,
-        size,
-        PROT_READ | PROT_WRITE,
-        POSIX_MADV_RANDOM |
-            POSIX_MADV_NORMAL |
-            POSIX_MADV_WILLNEED |
-            MAP_PRIVATE |
-            MAP_ANONYMOUS,
+        HEAP_RESERVE + HUGE_PAGE,
+        PROT_NONE,
+        MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE,
         -1, 0);
 
-    if (!ptr)
+    if (ptr == MAP_FAILED)
     {
-        perror("Failed to allocate system memory");
-        exit(1);
+        heap_map = heap_base = heap_top = heap_end = NULL;
+        return;
     }
-    return ptr;
+
+    /* the aligned base sits inside the mapping, so keep ptr to unmap */
+    heap_map = ptr;
+    heap_base = heap_top = (char *)HUGE_ALIGN((uintptr_t)ptr);
+    heap_end = heap_base + HEAP_RESERVE;
 }
-void initialize_global_memory(void)
+
+static void release_heap(void)
 {
+    if (heap_map)
+        munmap(heap_map, HEAP_RESERVE + HUGE_PAGE);
 
-    mem = NULL;
-    machine.gc_work_list = NULL;
+    heap_map = heap_base = heap_top = heap_end = NULL;
+    heap_committed = 0;
+
+    free(spare);
+    spare = NULL;
+    spare_count = 0;
+    spare_len = 0;
+}
 
-    mem = request_system_memory(PAGE);
+static bool in_heap(void *ptr)
+{
+    return (char *)ptr >= heap_base && (char *)ptr < heap_end;
+}
 
-    mem->size = PAGE - OFFSET;
-    mem->next = NULL;
-    mem->mark = false;
-    // mem->next->size = PAGE;
-    // mem->next->next = NULL;
+static void *take_spare(size_t size)
+{
+    for (size_t i = 0; i < spare_count; i++)
+    {
+        Span *span = &spare[i];
 
-    size_t size = (sizeof(Stack) * TABLE_SIZE) + sizeof(Stack);
+        if (span->size < size)
+            continue;
 
-    machine.gray_stack = malloc(size);
-    machine.gray_stack->count = 0;
-    machine.gray_stack->top = machine.gray_stack;
-    machine.gray_stack->count = 0;
-    machine.gray_stack->len = MACHINE_STACK;
-    machine.gray_stack->size = size;
+        char *ptr = span->addr;
+        span->addr += size;
+        span->size -= size;
 
-    machine.gc_work_list = NULL;
-    machine.gc_work_list_head = NULL;
+        if (span->size == 0)
+            *span = spare[--spare_count];
+        return ptr;
+    }
+    return NULL;
 }
 
-static void reinitialize_free_list(void)
+static void put_spare(char *ptr, size_t size)
 {
-    mem = NULL;
-    mem = request_system_memory(PAGE);
-    mem->next = NULL;
-    mem->mark = false;
-    mem->size = PAGE - OFFSET;
+    if (spare_count + 1 > spare_len)
+    {
+        spare_len = GROW_CAPACITY(spare_len);
+        spare = realloc(spare, spare_len * sizeof(Span));
+
+        if (!spare)
+        {
+            perror("Failed to reallocate spare spans.");
+            exit(1);
+        }
+    }
+
+    spare[spare_count].addr = ptr;
+    spare[spare_count++].size = size;
 }
 
-void destroy_global_memory(void)
+static void release_system_memory(char *ptr, size_t size)
 {
+    if (!in_heap(ptr))
+    {
+        munmap(ptr, size);
+        return;
+    }
 
-    Free *tmp = NULL;
+    madvise(ptr, size, MADV_DONTNEED);
 
-    while (mem)
+    if (ptr + size != heap_top)
     {
-
-        tmp = mem->next;
-        munmap(mem, mem->size);
-        mem = tmp;
+        put_spare(ptr, size);
+        return;
     }
-    mem = NULL;
-    tmp = NULL;
 
-    free(machine.gray_stack);
-    machine.gray_stack = NULL;
+    heap_top = ptr;
+
+    /* holes that now touch the top fold back into it */
+    for (size_t i = 0; i < spare_count;)
+        if (spare[i].addr + spare[i].size == heap_top)
+        {
+            heap_top = spare[i].addr;
+            spare[i] = spare[--spare_count];
+            i = 0;
+        }
+        else
+            i++;
 }
 
-Arena arena_init(void *data, size_t size, T type)
+static void *request_system_memory(size_t size)
 {
-    Arena ar;
+    char *ptr = take_spare(size);
 
-    switch (type)
+    if (ptr)
+        return ptr;
+
+    ptr = heap_top;
+
+    if (size >= HUGE_PAGE)
+        ptr = (char *)HUGE_ALIGN((uintptr_t)ptr);
+
+    if (heap_base && ptr + size <= heap_end)
     {
-    case ARENA_BYTES:
-        ar.listof.Bytes = data;
-        ar.len = (int)size;
-        ar.count = 0;
-        break;
-    case ARENA_SHORTS:
-        ar.listof.Shorts = data;
-        ar.len = (int)(size / sizeof(uint16_t));
-        ar.count = 0;
-        break;
-    case ARENA_STR:
-    case ARENA_FUNC:
-    case ARENA_VAR:
-    case ARENA_NATIVE:
-        ar.as.String = data;
-        ar.as.len = (int)size;
-        ar.as.count = 0;
-        break;
-    case ARENA_INTS:
-        ar.listof.Ints = data;
-        ar.len = (int)(size / sizeof(int));
-        ar.count = 0;
-        break;
-    case ARENA_DOUBLES:
-        ar.listof.Doubles = data;
-        ar.len = ((int)(size / sizeof(double)));
-        ar.count = 0;
-        break;
-    case ARENA_LONGS:
-        ar.listof.Longs = data;
-        ar.len = ((int)(size / sizeof(long long int)));
-        ar.count = 0;
-        break;
-    case ARENA_STRS:
-        ar.listof.Strings = data;
-        ar.len = ((int)(size / sizeof(char *)));
-        ar.count = 0;
-        break;
-    default:
-        return Null();
+        if (mprotect(ptr, size, PROT_READ | PROT_WRITE))
+        {
+            perror("Failed to commit system memory");
+            exit(1);
+        }
+        heap_top = ptr + size;
     }
-    ar.size = size;
-    ar.type = type;
-    return ar;
+    else
+    {
+        ptr = mmap(
+            NULL,
+            size,
+            PROT_READ | PROT_WRITE,
+            MAP_PRIVATE | MAP_ANONYMOUS,
+            -1, 0);
+
+        if (ptr == MAP_FAILED)
+        {
+            perror("Failed to allocate system memory");
+            exit(1);
+        }
+    }
+
+#ifdef MADV_HUGEPAGE
+    if (size >= HUGE_PAGE)
+        madvise(ptr, size, MADV_HUGEPAGE);
+#endif
+    return ptr;
 }
+/**
+    Exact-size bins up to SMALL_MAX, power-of-two ranges above;
+    bin_map has a bit per non-empty bin.
+*/
+static Free *bins[BIN_COUNT];
+static uint64_t bin_map;
 
 /**
-    TODO:
-        free off each String in String arena
+    Pages sorted by address, each with alloc, mark and gray bitmaps,
+    one bit per ALIGNMENT bytes.
 */
+static Free **pages;
+static size_t page_count;
+static size_t page_len;
 
-void arena_free(Arena *ar)
+/**
+    Young objects are bumped out of nursery chunks; a minor promotes
+    survivors in place. Collections only run at safepoints.
+*/
+typedef struct
 {
+    Free *page;
+    Free *start;
+    Free *end;
+} Nursery;
 
-    void *new = NULL;
+static Nursery *nursery;
+static size_t nursery_count;
+static size_t nursery_len;
+static Free *bump;
 
-    switch (ar->type)
+/**
+    Fixed-size runs for the small runtime objects; freed blocks go
+    back on their slab's list, never to the bins.
+*/
+typedef enum
+{
+    SLAB_CLOSURE,
+    SLAB_UPVAL,
+    SLAB_CLASS,
+    SLAB_INSTANCE,
+    SLAB_NATIVE,
+    SLAB_FUNCTION,
+    SLAB_COUNT
+} SlabKind;
+
+typedef struct
+{
+    size_t size;
+    Free *free;
+} Slab;
+
+static Slab slabs[SLAB_COUNT];
+static Free **slab_young;
+static size_t slab_young_count;
+static size_t slab_young_len;
+
+/**
+    Compiler scratch outside the heap, dropped at once by region_free().
+*/
+typedef struct Region Region;
+
+struct Region
+{
+    Region *next;
+    size_t used;
+    size_t size;
+};
+
+static Region *region;
+static int region_depth;
+
+/**
+    Majors mark incrementally, gc_pause microseconds per safepoint;
+    blocks allocated meanwhile are born black.
+*/
+static bool marking;
+static bool marking_old;
+static long gc_pause;
+
+/**
+    Lazy sweep: one page per trip to the bins. Pages at or above
+    sweep_at still hold last cycle's marks.
+*/
+static bool sweeping;
+static char *sweep_at;
+
+/* gives idle pages back between HEAP_TRIM_HIGH and HEAP_TRIM_LOW times the live bytes */
+static bool trim_requested;
+
+/**
+    Evacuates string and array payloads out of sparse pages, leaving
+    a forward in `next` until the sweep. Nothing else moves.
+*/
+static bool compact_requested;
+static bool evacuating;
+static Free **sparse;
+static size_t sparse_count;
+static size_t sparse_len;
+static Arena *strs_seen;
+static size_t strs_count;
+static size_t strs_len;
+
+/* pauses are wall-clock microseconds spent at a safepoint */
+static GcStats stats;
+static size_t cycle_marked;
+
+/**
+    Weak table of strings longer than SMALL_STR, shared by text;
+    prune_interns() drops the dead ones after each collection.
+*/
+typedef struct
+{
+    long long int hash;
+    char *str;
+} Intern;
+
+static Intern *interns;
+static size_t intern_count;
+static size_t intern_cap;
+
+/**
+    YKES_GC_HEAP_INIT, YKES_GC_GROWTH, YKES_GC_MIN_INTERVAL,
+    YKES_GC_HEAP_TARGET, YKES_GC_COMPACT and YKES_GC_HEAP_LIMIT,
+    or --gc-NAME=VALUE; sizes take a K, M or G suffix.
+*/
+typedef struct
+{
+    size_t heap_init;
+    double growth;
+    size_t min_interval;
+    size_t heap_target;
+    size_t heap_limit;
+    bool compact;
+} Tuning;
+
+static Tuning tuning;
+static size_t major_start;
+static bool limit_pending;
+static bool heap_full;
+
+/* old blocks the allocating code may hold before any root does */
+#define FRESH_OLD 16
+static Free *fresh_old[FRESH_OLD];
+static unsigned fresh_at;
+static bool pinning;
+
+static size_t env_size(const char *name, size_t fallback)
+{
+    char *end = NULL, *val = getenv(name);
+
+    if (!val)
+        return fallback;
+
+    size_t size = strtoull(val, &end, 10);
+
+    switch (*end)
     {
-    case ARENA_BYTES:
+    case 'G':
+    case 'g':
+        size <<= 10;
+        /* fall through */
+    case 'M':
+    case 'm':
+        size <<= 10;
+        /* fall through */
+    case 'K':
+    case 'k':
+        size <<= 10;
+    }
+    return size;
+}
 
-        if (!ar->listof.Bytes)
-            return;
-        new = (void *)ar->listof.Bytes;
-        ar->listof.Bytes = NULL;
-        break;
-    case ARENA_SHORTS:
+static void load_tuning(void)
+{
+    char *growth = getenv("YKES_GC_GROWTH");
+    char *compact = getenv("YKES_GC_COMPACT");
+
+    tuning.heap_init = env_size("YKES_GC_HEAP_INIT", GC_HEAP_INIT);
+    tuning.min_interval = env_size("YKES_GC_MIN_INTERVAL", GC_MIN_INTERVAL);
+    tuning.heap_target = env_size("YKES_GC_HEAP_TARGET", 0);
+    tuning.heap_limit = env_size("YKES_GC_HEAP_LIMIT", 0);
+    tuning.growth = growth ? strtod(growth, NULL) : INC;
+    tuning.compact = compact && strtol(compact, NULL, 10) != 0;
+
+    if (tuning.growth < 1.0)
+        tuning.growth = 1.0;
+}
 
-        if (!ar->listof.Shorts)
-            return;
-        new = (void *)ar->listof.Shorts;
-        ar->listof.Shorts = NULL;
-        break;
-    case ARENA_STR:
-    case ARENA_FUNC:
-    case ARENA_NATIVE:
-    case ARENA_VAR:
-        if (!ar->as.String)
-            return;
-        new = (void *)ar->as.String;
-        ar->as.String = NULL;
-        break;
-    case ARENA_INTS:
-        if (!ar->listof.Ints)
-            return;
-        new = (void *)ar->listof.Ints;
-        ar->listof.Ints = NULL;
-        break;
-    case ARENA_DOUBLES:
-        if (!ar->listof.Doubles)
-            return;
-        new = (void *)ar->listof.Doubles;
-        ar->listof.Doubles = NULL;
-        break;
-    case ARENA_LONGS:
-        if (!ar->listof.Longs)
-            return;
-        new = (void *)ar->listof.Longs;
-        ar->listof.Longs = NULL;
-        break;
-    case ARENA_STRS:
-        if (!ar->listof.Strings)
-            return;
-        new = (void *)ar->listof.Strings;
-        ar->listof.Strings = NULL;
-        break;
-    default:
+/**
+    A drain of GC_PAR_MIN or more grays is shared out to gc_threads
+    markers that steal from each other.
+*/
+typedef struct
+{
+    pthread_mutex_t lock;
+    Element *items;
+    int count;
+    int len;
+} Marker;
+
+static Marker *markers;
+static pthread_t *marker_ids;
+static int gc_threads;
+static int markers_idle;
+static int markers_busy;
+static unsigned mark_epoch;
+static bool markers_quit;
+static pthread_mutex_t pool_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t pool_wake = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t pool_done = PTHREAD_COND_INITIALIZER;
+static _Thread_local Marker *self;
+
+static inline int bin_index(size_t size)
+{
+    if (size <= SMALL_MAX)
+        return (int)(size / ALIGNMENT) - 1;
+
+    int bin = SMALL_BINS + (63 - __builtin_clzll(size)) - SMALL_SHIFT;
+    return (bin < BIN_COUNT) ? bin : BIN_COUNT - 1;
+}
+
+static void bin_push(Free *block)
+{
+    int bin = bin_index(block->size);
+
+    block->free = true;
+    block->young = false;
+    block->perm = false;
+    block->remembered = false;
+    block->moved = false;
+    block->slab = 0;
+    FREE_PREV(block) = NULL;
+    FREE_NEXT(block) = bins[bin];
+
+    if (bins[bin])
+        FREE_PREV(bins[bin]) = block;
+
+    bins[bin] = block;
+    bin_map |= (1ULL << bin);
+
+    FOOTER(block) = block->size;
+    NEXT_BLOCK(block)->prev_free = true;
+}
+
+static void bin_remove(Free *block)
+{
+    int bin = bin_index(block->size);
+
+    if (FREE_PREV(block))
+        FREE_NEXT(FREE_PREV(block)) = FREE_NEXT(block);
+    else
+        bins[bin] = FREE_NEXT(block);
+
+    if (FREE_NEXT(block))
+        FREE_PREV(FREE_NEXT(block)) = FREE_PREV(block);
+
+    if (!bins[bin])
+        bin_map &= ~(1ULL << bin);
+
+    block->free = false;
+    NEXT_BLOCK(block)->prev_free = false;
+}
+
+static Free *bin_pop(int bin)
+{
+    Free *block = bins[bin];
+    bin_remove(block);
+    return block;
+}
+
+static Free *find_block(size_t size)
+{
+    int bin = bin_index(size);
+
+    if (bins[bin] && bins[bin]->size >= size)
+        return bin_pop(bin);
+
+    uint64_t larger = bin_map & ~((2ULL << bin) - 1);
+
+    if (!larger)
+        return NULL;
+
+    return bin_pop(__builtin_ctzll(larger));
+}
+
+static void split_block(Free *block, size_t size)
+{
+    if (block->size - size < MIN_BLOCK)
         return;
-    }
 
-    FREE(PTR(new));
-    ar = NULL;
+    Free *rest = (Free *)((char *)block + size);
+    rest->size = block->size - size;
+    rest->prev_free = false;
+    block->size = size;
+    bin_push(rest);
 }
 
-static void merge_list(void)
+static Free *coalesce(Free *block)
 {
+    Free *next = NEXT_BLOCK(block);
 
-    Free *prev = NULL;
-    for (Free *free = mem; free; free = free->next)
+    /* a free young block is nursery space, not a bin entry */
+    if (next->free && !next->young)
     {
+        bin_remove(next);
+        block->size += next->size;
+    }
 
-        prev = free;
-        if (free->next && ((char *)(free + 1) + free->size) == (char *)free->next)
-        {
-            prev->size += free->next->size;
-            prev->next = free->next->next;
-        }
+    if (block->prev_free)
+    {
+        Free *prev = PREV_BLOCK(block);
+        bin_remove(prev);
+        prev->size += block->size;
+        block = prev;
     }
+
+    return block;
 }
 
-bool _null(Element el)
+static inline bool is_large(Free *page)
 {
-    switch (el.type)
-    {
-    case ARENA:
-    {
-        Arena ar = el.arena;
-        switch (ar.type)
-        {
-        case ARENA_STR:
-        case ARENA_CSTR:
-        case ARENA_VAR:
-        case ARENA_NATIVE:
-        case ARENA_FUNC:
-            return ar.as.String != NULL ? false : true;
-        case ARENA_BYTES:
-            return ar.listof.Bytes != NULL ? false : true;
-        case ARENA_INTS:
-            return ar.listof.Ints != NULL ? false : true;
+    return page->slab == LARGE_PAGE;
+}
+
+/* the bitmap words at the head of a page, and the bytes they take */
+static inline size_t page_words(Free *page)
+{
+    return is_large(page) ? 1 : PAGE_WORDS(page->size);
+}
+
+static inline size_t page_meta(Free *page)
+{
+    return PAGE_HEADER + (is_large(page) ? LARGE_META : PAGE_META(page->size));
+}
+
+static inline uint64_t *alloc_bits(Free *page)
+{
+    return (uint64_t *)((char *)page + PAGE_HEADER);
+}
+
+static inline uint64_t *mark_bits(Free *page)
+{
+    return alloc_bits(page) + page_words(page);
+}
+
+static inline uint64_t *gray_bits(Free *page)
+{
+    return mark_bits(page) + page_words(page);
+}
+
+static inline size_t bit_index(Free *page, Free *block)
+{
+    return (size_t)((char *)block - (char *)page) / ALIGNMENT;
+}
+
+static inline bool test_bit(uint64_t *bits, size_t i)
+{
+    return (bits[i / 64] >> (i % 64)) & 1;
+}
+
+static inline void set_bit(uint64_t *bits, size_t i)
+{
+    bits[i / 64] |= 1ULL << (i % 64);
+}
+
+static inline void clear_bit(uint64_t *bits, size_t i)
+{
+    bits[i / 64] &= ~(1ULL << (i % 64));
+}
+
+/* returns false when another marker got there first */
+static inline bool claim_bit(uint64_t *bits, size_t i)
+{
+    uint64_t bit = 1ULL << (i % 64);
+    return !(__atomic_fetch_or(&bits[i / 64], bit, __ATOMIC_RELAXED) & bit);
+}
+
+static Free *page_of(void *ptr)
+{
+    size_t lo = 0, hi = page_count;
+
+    while (lo < hi)
+    {
+        size_t mid = (lo + hi) / 2;
+
+        if ((char *)pages[mid] <= (char *)ptr)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+
+    if (lo == 0)
+        return NULL;
+
+    Free *page = pages[lo - 1];
+    return ((char *)ptr < (char *)page + page->size) ? page : NULL;
+}
+
+/* the page of a block the heap handed out and has not taken back */
+Free *block_page(Free *block)
+{
+    Free *page = page_of(block);
+
+    if (!page || ((char *)block - (char *)page) % ALIGNMENT)
+        return NULL;
+
+    return test_bit(alloc_bits(page), bit_index(page, block)) ? page : NULL;
+}
+
+/* markers share the gray words, so they change atomically */
+static void set_gray(Free *page, Free *block, bool gray)
+{
+    size_t i = bit_index(page, block);
+    uint64_t bit = 1ULL << (i % 64);
+
+    if (gray)
+        __atomic_fetch_or(&gray_bits(page)[i / 64], bit, __ATOMIC_RELAXED);
+    else
+        __atomic_fetch_and(&gray_bits(page)[i / 64], ~bit, __ATOMIC_RELAXED);
+}
+
+static bool is_gray(Free *block)
+{
+    Free *page = block_page(block);
+    return page && test_bit(gray_bits(page), bit_index(page, block));
+}
+
+static void ungray(Free *block)
+{
+    Free *page = block_page(block);
+
+    if (page)
+        set_gray(page, block, false);
+}
+
+static void insert_page(Free *page)
+{
+    if (page_count + 1 > page_len)
+    {
+        page_len = GROW_CAPACITY(page_len);
+        pages = realloc(pages, page_len * sizeof(Free *));
+
+        if (!pages)
+        {
+            perror("Failed to reallocate page table.");
+            exit(1);
+        }
+    }
+
+    size_t i = page_count++;
+    for (; i > 0 && (char *)pages[i - 1] > (char *)page; i--)
+        pages[i] = pages[i - 1];
+    pages[i] = page;
+}
+
+static void request_gc(Collection pass);
+static void emergency_collect(void);
+
+static size_t limit_mark(void)
+{
+    return (size_t)(tuning.heap_limit * GC_LIMIT_NEAR);
+}
+
+/* called before committing size more bytes */
+static void check_limit(size_t size)
+{
+    if (!tuning.heap_limit || evacuating || pinning)
+        return;
+
+    if (heap_committed + size > tuning.heap_limit && machine.collect)
+        emergency_collect();
+
+    if (heap_committed + size > tuning.heap_limit)
+    {
+        heap_full = true;
+        request_gc(GC_MINOR);
+        return;
+    }
+
+    if (!limit_pending && heap_committed + size >= limit_mark())
+    {
+        limit_pending = true;
+        trim_requested = true;
+        request_gc(GC_MAJOR);
+    }
+}
+
+/* the smallest page with room for size */
+static size_t page_fit(size_t size)
+{
+    size_t tmp = PAGE;
+
+    while (size + PAGE_HEADER + PAGE_META(tmp) + PAGE_FENCE > tmp)
+        tmp *= INC;
+    return tmp;
+}
+
+/* pages grow with the heap, never less than 1 / HEAP_GROWTH of it */
+static Free *request_page(size_t size)
+{
+    size_t tmp = page_fit(size);
+
+    while (tmp < heap_committed / HEAP_GROWTH)
+        tmp *= INC;
+
+    /* near the limit a page is only as big as the request needs */
+    if (tuning.heap_limit && heap_committed + tmp > limit_mark())
+        tmp = page_fit(size);
+
+    check_limit(tmp);
+
+    Free *page = request_system_memory(tmp);
+    page->size = tmp;
+    page->slab = 0;
+    heap_committed += tmp;
+    insert_page(page);
+
+    Free *fence = (Free *)((char *)page + tmp - PAGE_FENCE);
+    fence->size = 0;
+    fence->free = false;
+    fence->prev_free = false;
+    fence->young = false;
+
+    Free *block = (Free *)((char *)page + PAGE_HEADER + PAGE_META(tmp));
+    block->size = tmp - PAGE_HEADER - PAGE_META(tmp) - PAGE_FENCE;
+    block->free = false;
+    block->prev_free = false;
+    block->young = false;
+    block->slab = 0;
+    return block;
+}
+
+/* the block spanning a page whose every byte is back in the bins */
+static Free *idle_block(Free *page)
+{
+    size_t meta = page_meta(page);
+    Free *block = (Free *)((char *)page + meta);
+
+    if (block->free && !block->young && block->size == page->size - meta - PAGE_FENCE)
+        return block;
+    return NULL;
+}
+
+static size_t page_slot(Free *page)
+{
+    size_t lo = 0, hi = page_count;
+
+    while (lo < hi)
+    {
+        size_t mid = lo + (hi - lo) / 2;
+
+        if ((char *)pages[mid] < (char *)page)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    return lo;
+}
+
+static void remove_page(size_t i)
+{
+    heap_committed -= pages[i]->size;
+    memmove(&pages[i], &pages[i + 1], (page_count - i - 1) * sizeof(Free *));
+    page_count--;
+}
+
+static void release_page(size_t i)
+{
+    Free *page = pages[i];
+    size_t size = page->size;
+
+    bin_remove(idle_block(page));
+    remove_page(i);
+
+    release_system_memory((char *)page, size);
+}
+
+static void large_fence(Free *page)
+{
+    Free *fence = (Free *)((char *)page + page->size - PAGE_FENCE);
+    fence->size = 0;
+    fence->free = false;
+    fence->prev_free = false;
+    fence->young = false;
+}
+
+static Free *large_block(Free *page)
+{
+    Free *block = (Free *)((char *)page + page_meta(page));
+    block->size = page->size - page_meta(page) - PAGE_FENCE;
+    return block;
+}
+
+static Free *large_alloc(size_t size)
+{
+    size_t region = LARGE_REGION(size);
+
+    check_limit(region);
+
+    Free *page = mmap(
+        NULL,
+        region,
+        PROT_READ | PROT_WRITE,
+        MAP_PRIVATE | MAP_ANONYMOUS,
+        -1, 0);
+
+    if (page == MAP_FAILED)
+    {
+        perror("Failed to map large object");
+        exit(1);
+    }
+
+    page->size = region;
+    page->slab = LARGE_PAGE;
+    heap_committed += region;
+    insert_page(page);
+    large_fence(page);
+
+    Free *block = large_block(page);
+    block->free = false;
+    block->prev_free = false;
+    block->young = false;
+    block->slab = 0;
+    return block;
+}
+
+static void release_large(Free *page)
+{
+    size_t size = page->size;
+
+    remove_page(page_slot(page));
+    release_system_memory((char *)page, size);
+}
+
+/* hands idle pages back from the top down, never going below keep */
+static void trim_heap(size_t keep)
+{
+    for (size_t i = page_count; i-- > 0 && heap_committed > keep;)
+        if (idle_block(pages[i]) && heap_committed - pages[i]->size >= keep)
+            release_page(i);
+}
+
+void initialize_global_memory(void)
+{
+
+    reserve_heap();
+
+    pages = NULL;
+    page_count = 0;
+    page_len = 0;
+    bin_map = 0;
+    memset(bins, 0, sizeof(bins));
+
+    bin_push(request_page(0));
+
+    nursery = NULL;
+    nursery_count = 0;
+    nursery_len = 0;
+    bump = NULL;
+
+    slabs[SLAB_CLOSURE].size = ALIGN(OFFSET + sizeof(Closure));
+    slabs[SLAB_UPVAL].size = ALIGN(OFFSET + sizeof(Upval));
+    slabs[SLAB_CLASS].size = ALIGN(OFFSET + sizeof(Class));
+    slabs[SLAB_INSTANCE].size = ALIGN(OFFSET + sizeof(Instance));
+    slabs[SLAB_NATIVE].size = ALIGN(OFFSET + sizeof(Native));
+    slabs[SLAB_FUNCTION].size = ALIGN(OFFSET + sizeof(Function));
+    for (int i = 0; i < SLAB_COUNT; i++)
+    {
+        if (slabs[i].size < MIN_BLOCK)
+            slabs[i].size = MIN_BLOCK;
+        slabs[i].free = NULL;
+    }
+    slab_young = NULL;
+    slab_young_count = 0;
+    slab_young_len = 0;
+
+    marking = false;
+    marking_old = false;
+    sweeping = false;
+    sweep_at = NULL;
+    trim_requested = false;
+    compact_requested = false;
+    evacuating = false;
+    limit_pending = false;
+    heap_full = false;
+    memset(fresh_old, 0, sizeof(fresh_old));
+    pinning = false;
+    memset(&stats, 0, sizeof(stats));
+    cycle_marked = 0;
+
+    load_tuning();
+    major_start = 0;
+    machine.next_gc = tuning.heap_init;
+
+    char *pause = getenv("YKES_GC_PAUSE");
+    gc_pause = pause ? strtol(pause, NULL, 10) : GC_PAUSE_US;
+
+    char *threads = getenv("YKES_GC_THREADS");
+    gc_threads = threads ? (int)strtol(threads, NULL, 10)
+                         : (int)sysconf(_SC_NPROCESSORS_ONLN);
+    if (gc_threads < 1)
+        gc_threads = 1;
+    if (gc_threads > GC_MAX_THREADS)
+        gc_threads = GC_MAX_THREADS;
+    markers = NULL;
+    marker_ids = NULL;
+
+    size_t size = sizeof(Stack) * MACHINE_STACK;
+
+    machine.gray_stack = malloc(size);
+    machine.remembered = malloc(size);
+
+    if (!machine.gray_stack || !machine.remembered)
+    {
+        perror("Failed to allocate gc stacks.");
+        exit(1);
+    }
+
+    machine.gray_stack->count = 0;
+    machine.gray_stack->len = MACHINE_STACK;
+    machine.gray_stack->size = size;
+    machine.remembered->count = 0;
+    machine.remembered->len = MACHINE_STACK;
+    machine.remembered->size = size;
+
+    machine.gc_request = GC_NONE;
+
+    initialize_heap_dump();
+    initialize_tracer();
+}
+
+static void stop_markers(void);
+
+void destroy_global_memory(void)
+{
+    stop_markers();
+
+    for (size_t i = 0; i < page_count; i++)
+        if (!in_heap(pages[i]))
+            munmap(pages[i], pages[i]->size);
+    release_heap();
+
+    free(pages);
+    pages = NULL;
+    page_count = 0;
+    page_len = 0;
+
+    bin_map = 0;
+    memset(bins, 0, sizeof(bins));
+
+    free(machine.gray_stack);
+    machine.gray_stack = NULL;
+    free(machine.remembered);
+    machine.remembered = NULL;
+
+    free(nursery);
+    nursery = NULL;
+    nursery_count = 0;
+    nursery_len = 0;
+    bump = NULL;
+
+    for (int i = 0; i < SLAB_COUNT; i++)
+        slabs[i].free = NULL;
+    region_free();
+    free(slab_young);
+    slab_young = NULL;
+    slab_young_count = 0;
+    slab_young_len = 0;
+
+    destroy_profile();
+
+    free(sparse);
+    sparse = NULL;
+    sparse_count = 0;
+    sparse_len = 0;
+    free(strs_seen);
+    strs_seen = NULL;
+    strs_count = 0;
+    strs_len = 0;
+
+    free(interns);
+    interns = NULL;
+    intern_count = intern_cap = 0;
+}
+
+/* the string types that may hold their bytes in the Arena itself */
+static bool is_string(T type)
+{
+    switch (type)
+    {
+    case ARENA_STR:
+    case ARENA_VAR:
+    case ARENA_FUNC:
+    case ARENA_NATIVE:
+        return true;
+    default:
+        return false;
+    }
+}
+
+static void intern_place(Intern in)
+{
+    size_t i = (size_t)in.hash & (intern_cap - 1);
+
+    while (interns[i].str)
+        i = (i + 1) & (intern_cap - 1);
+    interns[i] = in;
+    intern_count++;
+}
+
+/* refills the table from old, skipping the slots cleared in it */
+static void rehash_interns(Intern *old, size_t cap)
+{
+    interns = calloc(intern_cap, sizeof(Intern));
+
+    if (!interns)
+    {
+        perror("Failed to reallocate intern table.");
+        exit(1);
+    }
+
+    intern_count = 0;
+    for (size_t i = 0; i < cap; i++)
+        if (old[i].str)
+            intern_place(old[i]);
+    free(old);
+}
+
+static void grow_interns(void)
+{
+    size_t cap = intern_cap;
+
+    intern_cap = intern_cap ? intern_cap * INC : CAPACITY;
+    rehash_interns(interns, cap);
+}
+
+/* the slot holding str, or the empty one where it would go */
+static Intern *intern_slot(long long int h, const char *str, size_t size)
+{
+    size_t i = (size_t)h & (intern_cap - 1);
+
+    for (; interns[i].str; i = (i + 1) & (intern_cap - 1))
+        if (interns[i].hash == h && !strncmp(interns[i].str, str, size) && !interns[i].str[size])
+            break;
+    return &interns[i];
+}
+
+static bool interned(Arena ar)
+{
+    if (!intern_cap || !is_string(ar.type) || ar.small || ar.grown || !ar.as.String)
+        return false;
+
+    for (size_t i = (size_t)ar.as.hash & (intern_cap - 1); interns[i].str; i = (i + 1) & (intern_cap - 1))
+        if (interns[i].str == ar.as.String)
+            return true;
+    return false;
+}
+
+static Arena intern_string(const char *str, T type)
+{
+    size_t size = strlen(str);
+
+    if (size <= SMALL_STR)
+        return small_string(str, size, type);
+
+    long long int h = CString(str).as.hash;
+
+    if ((intern_count + 1) * INC > intern_cap)
+        grow_interns();
+
+    Intern *in = intern_slot(h, str, size);
+
+    if (!in->str)
+    {
+        Arena fresh = arena_alloc(size + 1, type);
+        memcpy(fresh.as.String, str, size + 1);
+
+        /* a compiler region is dropped whole, so its strings stay out */
+        if (!block_page(PTR(fresh.as.String)))
+        {
+            fresh.size = size;
+            fresh.as.len = (int)size;
+            fresh.as.hash = h;
+            return fresh;
+        }
+        *in = (Intern){h, fresh.as.String};
+        intern_count++;
+    }
+
+    Arena ar = arena_init(in->str, size, type);
+    ar.as.hash = h;
+    ar.interned = 1;
+    return ar;
+}
+
+/* the unused tail of as.Small is zeroed so equal strings compare equal */
+Arena small_string(const char *str, size_t size, T type)
+{
+    Arena ar;
+
+    memset(&ar.as, 0, sizeof(ar.as));
+    memcpy(ar.as.Small, str, size);
+    ar.size = size;
+    ar.small = 1;
+    ar.grown = 0;
+    ar.interned = 0;
+    ar.type = type;
+    ar.as.hash = hash(ar);
+    return ar;
+}
+
+/* copies a small, grown or interned string into a block of its own, for code that writes through it or keeps its char * */
+Arena spill_string(Arena ar)
+{
+    if (!is_string(ar.type) || !(ar.small || ar.grown || interned(ar)))
+        return ar;
+
+    long long int h = ar.as.hash;
+    size_t size = ar.size;
+    Arena str = arena_alloc(size + 1, ar.type);
+
+    memcpy(str.as.String, ar.small ? ar.as.Small : ar.as.String, size);
+    str.as.String[size] = '\0';
+    str.size = size;
+    str.as.len = (int)size;
+    str.as.hash = h;
+    return str;
+}
+
+Arena arena_init(void *data, size_t size, T type)
+{
+    Arena ar;
+
+    switch (type)
+    {
+    case ARENA_BYTES:
+        ar.listof.Bytes = data;
+        ar.len = (int)size;
+        ar.count = 0;
+        break;
+    case ARENA_SHORTS:
+        ar.listof.Shorts = data;
+        ar.len = (int)(size / sizeof(uint16_t));
+        ar.count = 0;
+        break;
+    case ARENA_STR:
+    case ARENA_FUNC:
+    case ARENA_VAR:
+    case ARENA_NATIVE:
+        ar.as.String = data;
+        ar.as.len = (int)size;
+        ar.as.count = 0;
+        ar.as.hash = 0;
+        break;
+    case ARENA_INTS:
+        ar.listof.Ints = data;
+        ar.len = (int)(size / sizeof(int));
+        ar.count = 0;
+        break;
+    case ARENA_DOUBLES:
+        ar.listof.Doubles = data;
+        ar.len = ((int)(size / sizeof(double)));
+        ar.count = 0;
+        break;
+    case ARENA_LONGS:
+        ar.listof.Longs = data;
+        ar.len = ((int)(size / sizeof(long long int)));
+        ar.count = 0;
+        break;
+    case ARENA_STRS:
+        ar.listof.Strings = data;
+        ar.len = ((int)(size / sizeof(char *)));
+        ar.count = 0;
+        break;
+    default:
+        return Null();
+    }
+    ar.size = size;
+    ar.small = 0;
+    ar.grown = 0;
+    ar.interned = 0;
+    ar.type = type;
+    return ar;
+}
+
+/**
+    TODO:
+        free off each String in String arena
+*/
+
+void arena_free(Arena *ar)
+{
+
+    void *new = NULL;
+
+    switch (ar->type)
+    {
+    case ARENA_BYTES:
+
+        if (!ar->listof.Bytes)
+            return;
+        new = (void *)ar->listof.Bytes;
+        ar->listof.Bytes = NULL;
+        break;
+    case ARENA_SHORTS:
+
+        if (!ar->listof.Shorts)
+            return;
+        new = (void *)ar->listof.Shorts;
+        ar->listof.Shorts = NULL;
+        break;
+    case ARENA_STR:
+    case ARENA_FUNC:
+    case ARENA_NATIVE:
+    case ARENA_VAR:
+        /* a grown or interned block may back other strings; the collector frees it */
+        if (ar->small || ar->grown || !ar->as.String || interned(*ar))
+            return;
+        new = (void *)ar->as.String;
+        ar->as.String = NULL;
+        break;
+    case ARENA_INTS:
+        if (!ar->listof.Ints)
+            return;
+        new = (void *)ar->listof.Ints;
+        ar->listof.Ints = NULL;
+        break;
+    case ARENA_DOUBLES:
+        if (!ar->listof.Doubles)
+            return;
+        new = (void *)ar->listof.Doubles;
+        ar->listof.Doubles = NULL;
+        break;
+    case ARENA_LONGS:
+        if (!ar->listof.Longs)
+            return;
+        new = (void *)ar->listof.Longs;
+        ar->listof.Longs = NULL;
+        break;
+    case ARENA_STRS:
+        if (!ar->listof.Strings)
+            return;
+        new = (void *)ar->listof.Strings;
+        ar->listof.Strings = NULL;
+        break;
+    default:
+        return;
+    }
+
+    FREE(PTR(new));
+    ar = NULL;
+}
+
+bool _null(Element el)
+{
+    switch (el.type)
+    {
+    case ARENA:
+    {
+        Arena ar = el.arena;
+        switch (ar.type)
+        {
+        case ARENA_STR:
+        case ARENA_CSTR:
+        case ARENA_VAR:
+        case ARENA_NATIVE:
+        case ARENA_FUNC:
+            return (ar.small || ar.as.String) ? false : true;
+        case ARENA_BYTES:
+            return ar.listof.Bytes != NULL ? false : true;
+        case ARENA_INTS:
+            return ar.listof.Ints != NULL ? false : true;
+        case ARENA_DOUBLES:
+            return ar.listof.Doubles != NULL ? false : true;
+        case ARENA_LONGS:
+            return ar.listof.Longs != NULL ? false : true;
+        case ARENA_BOOLS:
+            return ar.listof.Bools != NULL ? false : true;
+        case ARENA_SIZES:
+            return ar.listof.Sizes != NULL ? false : true;
+        case ARENA_STRS:
+            return ar.listof.Strings != NULL ? false : true;
+        default:
+            return true;
+        }
+    }
+    case TABLE:
+        return el.table != NULL ? false : true;
+    case VECTOR:
+        return el.arena_vector != NULL ? false : true;
+    case CLOSURE:
+        return el.closure != NULL ? false : true;
+    case CLASS:
+        return el.classc != NULL ? false : true;
+    case INSTANCE:
+        return el.instance != NULL ? false : true;
+    case STACK:
+        return el.stack != NULL ? false : true;
+    default:
+        return true;
+    }
+    return true;
+}
+
+bool is_obj(Element el)
+{
+    switch (el.type)
+    {
+    case ARENA:
+        switch (el.arena.type)
+        {
+        case ARENA_BYTES:
+        case ARENA_SHORTS:
+        case ARENA_INTS:
+        case ARENA_DOUBLES:
+        case ARENA_LONGS:
+        case ARENA_BOOLS:
+        case ARENA_SIZES:
+        case ARENA_STRS:
+        case ARENA_FUNC:
+        case ARENA_STR:
+        case ARENA_NATIVE:
+        case ARENA_VAR:
+            return true;
+        default:
+            return false;
+        }
+    case TABLE:
+    case NATIVE:
+    case CLASS:
+    case INSTANCE:
+    case CLOSURE:
+    case FUNCTION:
+    case VECTOR:
+    case STACK:
+    case METHOD:
+        return true;
+    default:
+        return false;
+    }
+}
+
+static void gc_push(Stack **s, Element el)
+{
+    Stack *st = *s;
+
+    if (st->count + 1 > st->len)
+    {
+        int len = GROW_CAPACITY(st->len);
+        st = realloc(st, len * sizeof(Stack));
+
+        if (!st)
+        {
+            perror("Failed to reallocate gc stack.");
+            exit(1);
+        }
+        st->len = len;
+        *s = st;
+    }
+
+    st[st->count++].as = el;
+}
+
+static void marker_push(Marker *m, Element el)
+{
+    pthread_mutex_lock(&m->lock);
+
+    if (m->count + 1 > m->len)
+    {
+        m->len = GROW_CAPACITY(m->len);
+        m->items = realloc(m->items, m->len * sizeof(Element));
+
+        if (!m->items)
+        {
+            perror("Failed to reallocate marker stack.");
+            exit(1);
+        }
+    }
+
+    m->items[m->count++] = el;
+    pthread_mutex_unlock(&m->lock);
+}
+
+static bool marker_pop(Marker *m, Element *el)
+{
+    bool found = false;
+
+    pthread_mutex_lock(&m->lock);
+    if (m->count > 0)
+    {
+        *el = m->items[--m->count];
+        found = true;
+    }
+    pthread_mutex_unlock(&m->lock);
+
+    return found;
+}
+
+Free *obj_block(Element el)
+{
+    switch (el.type)
+    {
+    case ARENA:
+        switch (el.arena.type)
+        {
+        case ARENA_BYTES:
+        case ARENA_SHORTS:
+        case ARENA_INTS:
         case ARENA_DOUBLES:
-            return ar.listof.Doubles != NULL ? false : true;
         case ARENA_LONGS:
-            return ar.listof.Longs != NULL ? false : true;
         case ARENA_BOOLS:
-            return ar.listof.Bools != NULL ? false : true;
         case ARENA_SIZES:
-            return ar.listof.Sizes != NULL ? false : true;
         case ARENA_STRS:
-            return ar.listof.Strings != NULL ? false : true;
+            return el.arena.listof.Void ? PTR(el.arena.listof.Void) : NULL;
+        case ARENA_STR:
+        case ARENA_CSTR:
+        case ARENA_FUNC:
+        case ARENA_NATIVE:
+        case ARENA_VAR:
+            return (!el.arena.small && el.arena.as.String) ? PTR(el.arena.as.String) : NULL;
         default:
+            return NULL;
+        }
+    case TABLE:
+        return el.table ? PTR((el.table - 1)) : NULL;
+    case VECTOR:
+        return el.arena_vector ? PTR((el.arena_vector - 1)) : NULL;
+    case STACK:
+        return el.stack ? PTR((el.stack - 1)) : NULL;
+    case NATIVE:
+    case CLASS:
+    case INSTANCE:
+    case CLOSURE:
+    case METHOD:
+    case FUNCTION:
+    case UPVAL:
+        return el.null ? PTR(el.null) : NULL;
+    default:
+        return NULL;
+    }
+}
+
+static bool is_marked(Free *block)
+{
+    Free *page = block_page(block);
+    return page && test_bit(mark_bits(page), bit_index(page, block));
+}
+
+/* a minor only marks young blocks; old ones are live by fiat */
+static bool mark_block(Free *block)
+{
+    Free *page = NULL;
+
+    if (!block || !(page = block_page(block)))
+        return false;
+    if (!marking_old && !block->young)
+        return false;
+    if (!claim_bit(mark_bits(page), bit_index(page, block)))
+        return false;
+
+    __atomic_fetch_add(&cycle_marked, block->size, __ATOMIC_RELAXED);
+    return true;
+}
+
+static void mark_leaf(void *ptr)
+{
+    if (ptr)
+        mark_block(PTR(ptr));
+}
+
+void mark_obj(Element el)
+{
+    if (!marking)
+        return;
+
+    Free *block = obj_block(el);
+
+    if (!mark_block(block))
+        return;
+
+    if (el.type == ARENA && el.arena.type != ARENA_STRS)
+        return;
+
+    set_gray(block_page(block), block, true);
+
+    if (self)
+        marker_push(self, el);
+    else
+        gc_push(&machine.gray_stack, el);
+}
+
+void mark_value(Element el)
+{
+    mark_obj(el);
+}
+
+static void keep_strings(Arena ar)
+{
+    if (strs_count + 1 > strs_len)
+    {
+        strs_len = GROW_CAPACITY(strs_len);
+        strs_seen = realloc(strs_seen, strs_len * sizeof(Arena));
+
+        if (!strs_seen)
+        {
+            perror("Failed to reallocate string arrays.");
+            exit(1);
+        }
+    }
+    strs_seen[strs_count++] = ar;
+}
+
+static bool is_sparse(Free *page)
+{
+    size_t lo = 0, hi = sparse_count;
+
+    while (lo < hi)
+    {
+        size_t mid = lo + (hi - lo) / 2;
+
+        if (sparse[mid] == page)
             return true;
+        if ((char *)sparse[mid] < (char *)page)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    return false;
+}
+
+/* copies a block out of a sparse page, white, and leaves a forward */
+static Free *evacuate(Free *old)
+{
+    Free *block = NULL, *page = NULL;
+
+    if (!(block = find_block(old->size)))
+        block = request_page(old->size);
+
+    split_block(block, old->size);
+    memcpy(block + 1, old + 1, block->size - OFFSET);
+
+    block->free = false;
+    block->young = false;
+    block->perm = false;
+    block->remembered = false;
+    block->moved = false;
+
+    page = page_of(block);
+    set_bit(alloc_bits(page), bit_index(page, block));
+    clear_bit(gray_bits(page), bit_index(page, block));
+
+    old->moved = true;
+    FREE_NEXT(old) = block;
+
+    if (machine.profile)
+        profile_move(old, block);
+
+    machine.bytes_allocated += block->size;
+    stats.moved += block->size;
+    return block;
+}
+
+static void *forward(void *ptr)
+{
+    Free *block = NULL, *page = NULL;
+
+    if (!ptr || !(page = block_page(block = PTR(ptr))))
+        return ptr;
+    if (block->perm || block->young || !is_sparse(page))
+        return ptr;
+    if (block->moved)
+        return FREE_NEXT(block) + 1;
+
+    /* already marked where it is through a path that cannot move it */
+    if (test_bit(mark_bits(page), bit_index(page, block)))
+        return ptr;
+
+    return evacuate(block) + 1;
+}
+
+static void relocate_arena(Arena *ar)
+{
+    switch (ar->type)
+    {
+    case ARENA_BYTES:
+    case ARENA_SHORTS:
+    case ARENA_INTS:
+    case ARENA_DOUBLES:
+    case ARENA_LONGS:
+    case ARENA_BOOLS:
+    case ARENA_SIZES:
+    case ARENA_STRS:
+        ar->listof.Void = forward(ar->listof.Void);
+        break;
+    case ARENA_STR:
+    case ARENA_CSTR:
+    case ARENA_FUNC:
+    case ARENA_NATIVE:
+    case ARENA_VAR:
+        if (!ar->small)
+            ar->as.String = forward(ar->as.String);
+        break;
+    default:
+        break;
+    }
+}
+
+static void trace_arena(Arena *ar)
+{
+    if (evacuating)
+        relocate_arena(ar);
+    mark_obj(OBJ(*ar));
+}
+
+static void trace_value(Element *el)
+{
+    if (evacuating && el->type == ARENA)
+        relocate_arena(&el->arena);
+    if (evacuating && el->type == VECTOR && el->arena_vector)
+        el->arena_vector = (Arena *)forward(el->arena_vector - 1) + 1;
+    mark_obj(*el);
+}
+
+static void mark_stack(Stack *s)
+{
+    if (!s)
+        return;
+
+    size_t cap = (PTR((s - 1))->size - OFFSET) / sizeof(Stack) - 1;
+    size_t len = (size_t)(s->top - s);
+
+    if (s->top < s || len < (size_t)s->count)
+        len = (size_t)s->count;
+    if (len > cap)
+        len = cap;
+
+    for (size_t i = 0; i < len; i++)
+        trace_value(&s[i].as);
+}
+
+static void mark_entry(Table *entry)
+{
+    if (entry->key.type != ARENA_NULL)
+        trace_arena(&entry->key);
+    trace_value(&entry->val);
+}
+
+void mark_table(Table **t)
+{
+    Table *tab = *t;
+
+    if (!tab)
+        return;
+
+    size_t cap = (PTR((tab - 1))->size - OFFSET) / sizeof(Table) - 1;
+    size_t len = (size_t)(tab - 1)->len;
+
+    if (len > cap)
+        len = cap;
+
+    for (size_t i = 0; i < len; i++)
+    {
+        mark_entry(&tab[i]);
+
+        for (Table *e = tab[i].next; e; e = e->next)
+        {
+            mark_leaf(e);
+            mark_entry(e);
         }
     }
+}
+
+static void mark_vector(Arena *vec)
+{
+    size_t cap = (PTR((vec - 1))->size - OFFSET) / sizeof(Arena) - 1;
+    size_t len = (size_t)(vec - 1)->count;
+
+    if (len > cap)
+        len = cap;
+
+    for (size_t i = 0; i < len; i++)
+        trace_arena(&vec[i]);
+}
+
+/* a remembered copy of the Arena has a stale count, so scan it all */
+static void mark_strings(Arena ar)
+{
+    size_t cap = (PTR(ar.listof.Strings)->size - OFFSET) / sizeof(char *);
+
+    for (size_t i = 0; i < cap; i++)
+        mark_leaf(ar.listof.Strings[i]);
+}
+
+static void mark_closure(Closure *c)
+{
+    mark_value(FUNC(c->func));
+
+    if (!c->upvals)
+        return;
+
+    mark_leaf(c->upvals - 1);
+    for (int i = 0; i < c->upval_count; i++)
+        mark_value(UPVAL(c->upvals[i]));
+}
+
+static void mark_function(Function *f)
+{
+    trace_arena(&f->name);
+    mark_leaf(f->ch.cases.listof.Ints);
+    mark_leaf(f->ch.op_codes.listof.Shorts);
+    mark_leaf(f->ch.lines.listof.Ints);
+    mark_value(STK(f->ch.constants));
+}
+
+static void blacken_object(Element *el)
+{
+    if (!obj_block(*el))
+        return;
+
+    switch (el->type)
+    {
+    case ARENA:
+        if (el->arena.type != ARENA_STRS)
+            break;
+        if (evacuating)
+            keep_strings(el->arena);
+        mark_strings(el->arena);
+        break;
     case TABLE:
-        return el.table != NULL ? false : true;
+        mark_table(&el->table);
+        break;
     case VECTOR:
-        return el.arena_vector != NULL ? false : true;
+        mark_vector(el->arena_vector);
+        break;
+    case STACK:
+        mark_stack(el->stack);
+        break;
     case CLOSURE:
-        return el.closure != NULL ? false : true;
+    case METHOD:
+        mark_closure(el->closure);
+        break;
+    case FUNCTION:
+        mark_function(el->function);
+        break;
     case CLASS:
-        return el.classc != NULL ? false : true;
+        trace_arena(&el->classc->name);
+        mark_value(CLOSURE(el->classc->init));
+        mark_value(TABLE(el->classc->closures));
+        break;
     case INSTANCE:
-        return el.instance != NULL ? false : true;
-    case STACK:
-        return el.stack != NULL ? false : true;
+        mark_value(CLASS(el->instance->classc));
+        mark_value(TABLE(el->instance->fields));
+        break;
+    case NATIVE:
+        trace_arena(&el->native->obj);
+        break;
+    case UPVAL:
+        trace_value(&el->upval->closed);
+        mark_value(UPVAL(el->upval->next));
+        break;
     default:
-        return true;
+        return;
+    }
+}
+
+/* roots may already be old, so they are traced even when unindexed */
+static void mark_root(Element el)
+{
+    mark_block(obj_block(el));
+    blacken_object(&el);
+}
+
+static void mark_roots(void)
+{
+    for (Element *v = machine.stack; v < machine.stack_top; v++)
+        trace_value(v);
+
+    mark_root(STK(machine.call_stack));
+    mark_root(STK(machine.class_stack));
+    mark_root(STK(machine.native_calls));
+    mark_root(TABLE(machine.glob));
+
+    for (int i = 0; i < machine.frame_count; i++)
+        mark_root(CLOSURE(machine.frames[i].closure));
+
+    for (Upval *up = machine.open_upvals; up; up = up->next)
+        mark_root(UPVAL(up));
+
+    trace_value(&machine.e1);
+    trace_value(&machine.e2);
+    trace_value(&machine.e3);
+    trace_value(&machine.e4);
+    trace_value(&machine.e5);
+
+    trace_arena(&machine.r1);
+    trace_arena(&machine.r2);
+    trace_arena(&machine.r3);
+    trace_arena(&machine.r4);
+    trace_arena(&machine.r5);
+
+    /* a full trace from the roots needs no remembered set */
+    if (evacuating)
+        return;
+
+    for (int i = 0; i < machine.remembered->count; i++)
+        mark_root(machine.remembered[i].as);
+}
+
+static void blacken_next(void)
+{
+    Element el = machine.gray_stack[--machine.gray_stack->count].as;
+    ungray(obj_block(el));
+    blacken_object(&el);
+}
+
+/* takes the oldest half of a victim's stack, the widest subgraphs */
+static bool marker_steal(Marker *m)
+{
+    Element loot[GC_STEAL_MAX];
+    int id = (int)(m - markers);
+
+    for (int i = 1; i < gc_threads; i++)
+    {
+        Marker *victim = &markers[(id + i) % gc_threads];
+        int n = 0;
+
+        pthread_mutex_lock(&victim->lock);
+        if (victim->count > 0)
+        {
+            n = (victim->count + 1) / 2;
+            if (n > GC_STEAL_MAX)
+                n = GC_STEAL_MAX;
+
+            memcpy(loot, victim->items, n * sizeof(Element));
+            victim->count -= n;
+            memmove(victim->items, victim->items + n,
+                    victim->count * sizeof(Element));
+        }
+        pthread_mutex_unlock(&victim->lock);
+
+        for (int j = 0; j < n; j++)
+            marker_push(m, loot[j]);
+
+        if (n > 0)
+            return true;
+    }
+    return false;
+}
+
+static bool markers_have_work(void)
+{
+    for (int i = 0; i < gc_threads; i++)
+    {
+        pthread_mutex_lock(&markers[i].lock);
+        int count = markers[i].count;
+        pthread_mutex_unlock(&markers[i].lock);
+
+        if (count > 0)
+            return true;
+    }
+    return false;
+}
+
+/* only a busy marker pushes, so all idle means all stacks are empty */
+static void drain_marker(Marker *m)
+{
+    Element el;
+
+    for (;;)
+    {
+        while (marker_pop(m, &el))
+        {
+            ungray(obj_block(el));
+            blacken_object(&el);
+        }
+
+        if (marker_steal(m))
+            continue;
+
+        __atomic_add_fetch(&markers_idle, 1, __ATOMIC_SEQ_CST);
+
+        for (;;)
+        {
+            if (__atomic_load_n(&markers_idle, __ATOMIC_SEQ_CST) == gc_threads)
+                return;
+
+            if (markers_have_work())
+            {
+                __atomic_sub_fetch(&markers_idle, 1, __ATOMIC_SEQ_CST);
+                break;
+            }
+            sched_yield();
+        }
     }
-    return true;
 }
 
-bool is_obj(Element el)
+static void *marker_main(void *arg)
 {
-    switch (el.type)
+    Marker *m = arg;
+    unsigned seen = 0;
+
+    self = m;
+    pthread_mutex_lock(&pool_lock);
+
+    for (;;)
     {
-    case ARENA:
-        switch (el.arena.type)
+        while (mark_epoch == seen && !markers_quit)
+            pthread_cond_wait(&pool_wake, &pool_lock);
+
+        if (markers_quit)
+            break;
+
+        seen = mark_epoch;
+        pthread_mutex_unlock(&pool_lock);
+
+        drain_marker(m);
+
+        pthread_mutex_lock(&pool_lock);
+        if (--markers_busy == 0)
+            pthread_cond_signal(&pool_done);
+    }
+
+    pthread_mutex_unlock(&pool_lock);
+    return NULL;
+}
+
+static void start_markers(void)
+{
+    markers = calloc(gc_threads, sizeof(Marker));
+    marker_ids = calloc(gc_threads, sizeof(pthread_t));
+
+    if (!markers || !marker_ids)
+    {
+        perror("Failed to allocate markers.");
+        exit(1);
+    }
+
+    markers_quit = false;
+    mark_epoch = 0;
+
+    for (int i = 0; i < gc_threads; i++)
+        pthread_mutex_init(&markers[i].lock, NULL);
+
+    for (int i = 1; i < gc_threads; i++)
+        if (pthread_create(&marker_ids[i], NULL, marker_main, &markers[i]))
         {
-        case ARENA_BYTES:
-        case ARENA_SHORTS:
-        case ARENA_INTS:
-        case ARENA_DOUBLES:
-        case ARENA_LONGS:
-        case ARENA_BOOLS:
-        case ARENA_SIZES:
-        case ARENA_STRS:
-        case ARENA_FUNC:
-        case ARENA_STR:
-        case ARENA_NATIVE:
-        case ARENA_VAR:
-            return true;
-        default:
-            return false;
+            perror("Failed to start marker thread.");
+            exit(1);
         }
-    case TABLE:
-    case NATIVE:
-    case CLASS:
-    case INSTANCE:
-    case CLOSURE:
-    case FUNCTION:
-    case VECTOR:
-    case STACK:
-    case METHOD:
-        return true;
-    default:
-        return false;
-    }
 }
 
-void mark_obj(Element el)
+static void stop_markers(void)
 {
-    if (_null(el))
+    if (!markers)
         return;
 
-    Free **ptr = NULL;
+    pthread_mutex_lock(&pool_lock);
+    markers_quit = true;
+    pthread_cond_broadcast(&pool_wake);
+    pthread_mutex_unlock(&pool_lock);
 
-    switch (el.type)
+    for (int i = 1; i < gc_threads; i++)
+        pthread_join(marker_ids[i], NULL);
+
+    for (int i = 0; i < gc_threads; i++)
     {
-    case ARENA:
-        switch (el.arena.type)
+        pthread_mutex_destroy(&markers[i].lock);
+        free(markers[i].items);
+    }
+
+    free(markers);
+    free(marker_ids);
+    markers = NULL;
+    marker_ids = NULL;
+}
+
+static void parallel_trace(void)
+{
+    if (!markers)
+        start_markers();
+
+    for (int i = 0; machine.gray_stack->count > 0; i++)
+        marker_push(&markers[i % gc_threads],
+                    machine.gray_stack[--machine.gray_stack->count].as);
+
+    markers_idle = 0;
+
+    pthread_mutex_lock(&pool_lock);
+    markers_busy = gc_threads - 1;
+    mark_epoch++;
+    pthread_cond_broadcast(&pool_wake);
+    pthread_mutex_unlock(&pool_lock);
+
+    self = &markers[0];
+    drain_marker(self);
+    self = NULL;
+
+    pthread_mutex_lock(&pool_lock);
+    while (markers_busy > 0)
+        pthread_cond_wait(&pool_done, &pool_lock);
+    pthread_mutex_unlock(&pool_lock);
+}
+
+static void trace_references(void)
+{
+    while (machine.gray_stack->count > 0)
+    {
+        if (gc_threads > 1 && machine.gray_stack->count >= GC_PAR_MIN)
         {
-        case ARENA_BYTES:
-            ptr = (Free **)&el.arena.listof.Bytes;
-            break;
-        case ARENA_SHORTS:
-            ptr = (Free **)&el.arena.listof.Shorts;
-            break;
-        case ARENA_INTS:
-            ptr = (Free **)&el.arena.listof.Ints;
-            break;
-        case ARENA_DOUBLES:
-            ptr = (Free **)&el.arena.listof.Doubles;
-            break;
-        case ARENA_LONGS:
-            ptr = (Free **)&el.arena.listof.Longs;
-            break;
-        case ARENA_STRS:
-            ptr = (Free **)&el.arena.listof.Strings;
-            break;
-        case ARENA_FUNC:
-        case ARENA_NATIVE:
-        case ARENA_VAR:
-        case ARENA_STR:
-            ptr = (Free **)&el.arena.as.String;
-            break;
-        default:
+            parallel_trace();
             return;
         }
+        blacken_next();
+    }
+}
+
+/* returns true once the gray stack is empty */
+static bool trace_slice(void)
+{
+    clock_t start = clock();
+
+    if (gc_pause <= 0)
+    {
+        trace_references();
+        return true;
+    }
+
+    int n = 0;
+
+    while (machine.gray_stack->count > 0)
+    {
+        blacken_next();
+
+        if (++n % GC_SLICE_CHECK == 0 &&
+            (clock() - start) * 1000000 / CLOCKS_PER_SEC >= gc_pause)
+            return machine.gray_stack->count == 0;
+    }
+    return true;
+}
+
+void write_barrier(Element obj)
+{
+    Free *block = obj_block(obj);
+
+    if (!block || !machine.collect)
         return;
-    case TABLE:
+
+    /* a black container gaining a reference must be scanned again */
+    if (marking && !is_gray(block) && is_marked(block))
     {
-        Table *t = el.table - 1;
-        ptr = (Free **)&t;
+        set_gray(block_page(block), block, true);
+        gc_push(&machine.gray_stack, obj);
     }
-    break;
-    case NATIVE:
-        ptr = (Free **)&(el.native);
+
+    if (block->young || block->remembered)
         return;
-    case CLASS:
-        ptr = (Free **)&(el.classc);
-        break;
-    case FUNCTION:
-        ptr = (Free **)&(el.function);
-        break;
-    case INSTANCE:
-        ptr = (Free **)&(el.instance);
-        break;
-    case CLOSURE:
-    case METHOD:
-        ptr = (Free **)&(el.closure);
-        break;
-    case VECTOR:
+
+    block->remembered = true;
+    gc_push(&machine.remembered, obj);
+}
+
+static void drop_obj(Stack *s, Free *block)
+{
+    for (int i = 0; i < s->count; i++)
+        if (obj_block(s[i].as) == block)
+        {
+            s[i].as = s[--s->count].as;
+            break;
+        }
+}
+
+static void forget_obj(Free *block)
+{
+    drop_obj(machine.remembered, block);
+    block->remembered = false;
+}
+
+static void forget_all(void)
+{
+    Stack *r = machine.remembered;
+
+    while (r->count > 0)
+        obj_block(r[--r->count].as)->remembered = false;
+}
+
+static void release_span(Free *span)
+{
+    /* a header swallowed by coalesce must still read as free */
+    span->free = true;
+    span->young = false;
+    bin_push(coalesce(span));
+}
+
+static bool unswept(Free *block)
+{
+    return sweeping && (char *)block >= sweep_at;
+}
+
+static void slab_push(Free *block)
+{
+    Slab *slab = &slabs[block->slab - 1];
+
+    block->free = false;
+    block->young = false;
+    block->perm = false;
+    block->remembered = false;
+    block->moved = false;
+    FREE_PREV(block) = NULL;
+    FREE_NEXT(block) = slab->free;
+    slab->free = block;
+}
+
+/* the slab half of a minor: young slab objects die or grow old here */
+static void sweep_slabs(void)
+{
+    for (size_t i = 0; i < slab_young_count; i++)
     {
-        Arena *ar = el.arena_vector - 1;
-        ptr = (Free **)&ar;
-        break;
+        Free *block = slab_young[i], *page = page_of(block);
+        uint64_t *alloc = alloc_bits(page), *mark = mark_bits(page);
+        size_t bit = bit_index(page, block);
+
+        if (test_bit(alloc, bit) && test_bit(mark, bit))
+        {
+            if (!unswept(block))
+                clear_bit(mark, bit);
+            block->young = false;
+            continue;
+        }
+
+        if (test_bit(alloc, bit))
+        {
+            clear_bit(alloc, bit);
+            machine.bytes_allocated -= block->size;
+            stats.freed += block->size;
+        }
+        slab_push(block);
     }
-    case STACK:
+
+    slab_young_count = 0;
+}
+
+static void sweep_nursery(void)
+{
+    for (size_t i = 0; i < nursery_count; i++)
     {
-        Stack *s = el.stack - 1;
-        ptr = (Free **)&s;
-        break;
+        Free *page = nursery[i].page, *next = NULL, *span = NULL;
+        uint64_t *alloc = alloc_bits(page), *mark = mark_bits(page);
+
+        for (Free *block = nursery[i].start; block < nursery[i].end; block = next)
+        {
+            size_t bit = bit_index(page, block);
+            next = NEXT_BLOCK(block);
+
+            if (test_bit(alloc, bit) && test_bit(mark, bit))
+            {
+                if (span)
+                    release_span(span);
+                span = NULL;
+
+                if (!unswept(block))
+                    clear_bit(mark, bit);
+                block->young = false;
+                continue;
+            }
+
+            if (test_bit(alloc, bit))
+            {
+                clear_bit(alloc, bit);
+                machine.bytes_allocated -= block->size;
+                stats.freed += block->size;
+            }
+
+            if (span)
+                span->size += block->size;
+            else
+                span = block;
+        }
+
+        if (span)
+            release_span(span);
     }
-    default:
-        return;
+
+    nursery_count = 0;
+    bump = NULL;
+
+    sweep_slabs();
+}
+
+/* drops the interned blocks this collection found dead; a minor only judges young ones */
+static void prune_interns(bool old)
+{
+    bool dropped = false;
+
+    for (size_t i = 0; i < intern_cap; i++)
+    {
+        Free *block = NULL;
+
+        if (!interns[i].str)
+            continue;
+
+        block = PTR(interns[i].str);
+
+        if (block->moved)
+        {
+            block = FREE_NEXT(block);
+            interns[i].str = (char *)(block + 1);
+        }
+
+        if (block->perm || (!old && !block->young) || is_marked(block))
+            continue;
+
+        interns[i].str = NULL;
+        dropped = true;
+    }
+
+    if (dropped)
+        rehash_interns(interns, intern_cap);
+}
+
+static void end_cycle(void)
+{
+    stats.last_marked = cycle_marked;
+    stats.marked += cycle_marked;
+    cycle_marked = 0;
+}
+
+static void collect_minor(void)
+{
+    TRACE(TRACE_GC_BEGIN, GC_MINOR, machine.bytes_allocated);
+
+    stats.minors++;
+    marking = true;
+    marking_old = false;
+    mark_roots();
+    trace_references();
+    marking = false;
+
+    prune_interns(false);
+    forget_all();
+    sweep_nursery();
+    end_cycle();
+
+    TRACE(TRACE_GC_END, GC_MINOR, machine.bytes_allocated);
+}
+
+static void begin_major(void)
+{
+    TRACE(TRACE_GC_BEGIN, GC_MAJOR, machine.bytes_allocated);
+
+    major_start = machine.bytes_allocated;
+    marking = true;
+    marking_old = true;
+    mark_roots();
+}
+
+static bool fragmented(void)
+{
+    GcStats s = gc_stats();
+    return s.free_bytes > GC_COMPACT_MIN && s.fragmentation > GC_COMPACT_FRAG;
+}
+
+/* a page of old blocks whose marked ones fill little of it */
+static bool sparse_page(Free *page)
+{
+    uint64_t *alloc = alloc_bits(page), *mark = mark_bits(page);
+    size_t meta = page_meta(page), live = 0;
+
+    for (Free *block = (Free *)((char *)page + meta); block->size; block = NEXT_BLOCK(block))
+    {
+        size_t bit = bit_index(page, block);
+
+        if (!test_bit(alloc, bit))
+            continue;
+        if (block->perm || block->young)
+            return false;
+        if (test_bit(mark, bit))
+            live += block->size;
+    }
+    return live && live < (page->size - meta - PAGE_FENCE) / GC_COMPACT_SPARSE;
+}
+
+static void add_sparse(Free *page)
+{
+    if (sparse_count + 1 > sparse_len)
+    {
+        sparse_len = GROW_CAPACITY(sparse_len);
+        sparse = realloc(sparse, sparse_len * sizeof(Free *));
+
+        if (!sparse)
+        {
+            perror("Failed to reallocate sparse pages.");
+            exit(1);
+        }
+    }
+    sparse[sparse_count++] = page;
+}
+
+/* takes a page's free blocks out of the bins so nothing moves into it */
+static Free *hold_free(Free *page, Free *held)
+{
+    size_t meta = page_meta(page);
+
+    for (Free *block = (Free *)((char *)page + meta); block->size; block = NEXT_BLOCK(block))
+        if (block->free && !block->young)
+        {
+            bin_remove(block);
+            FREE_NEXT(block) = held;
+            held = block;
+        }
+    return held;
+}
+
+/* a slot may still name a string that moved after its array was scanned */
+static void forward_strings(void)
+{
+    for (size_t i = 0; i < strs_count; i++)
+    {
+        char **slots = strs_seen[i].listof.Strings;
+        size_t cap = (PTR(slots)->size - OFFSET) / sizeof(char *);
+
+        for (size_t j = 0; j < cap; j++)
+        {
+            Free *block = NULL;
+
+            if (slots[j] && block_page(block = PTR(slots[j])) &&
+                !block->young && block->moved)
+                slots[j] = (char *)(FREE_NEXT(block) + 1);
+        }
     }
+    strs_count = 0;
+}
+
+static void compact(void)
+{
+    Free *held = NULL, *next = NULL;
 
-    if ((*ptr)->mark)
-        return;
-    (*ptr)->mark = true;
+    compact_requested = false;
+    sparse_count = 0;
+
+    /* pages is sorted, so sparse is too */
+    for (size_t i = 0; i < page_count; i++)
+        if (sparse_page(pages[i]))
+            add_sparse(pages[i]);
 
-    if (el.type == CLOSURE || el.type == CLASS)
+    if (!sparse_count)
         return;
 
-    if (machine.gray_stack->count + 1 > machine.gray_stack->len)
-    {
-        machine.gray_stack->len = GROW_CAPACITY(machine.gray_stack->len);
-        machine.gray_stack = realloc(machine.gray_stack, machine.gray_stack->len);
-        machine.gray_stack->top = machine.gray_stack;
-    }
+    for (size_t i = 0; i < sparse_count; i++)
+        held = hold_free(sparse[i], held);
+
+    for (size_t i = 0; i < page_count; i++)
+        memset(mark_bits(pages[i]), 0, page_words(pages[i]) * sizeof(uint64_t));
+    cycle_marked = 0;
+
+    /* bins are not shared, so the markers sit this one out */
+    evacuating = true;
+    mark_roots();
+    while (machine.gray_stack->count > 0)
+        blacken_next();
+    evacuating = false;
 
-    if (!machine.gray_stack)
+    forward_strings();
+
+    for (; held; held = next)
     {
-        perror("Failed to reallocate gray_stack.");
-        exit(1);
+        next = FREE_NEXT(held);
+        bin_push(held);
     }
 
-    machine.gray_stack->count++;
-    (machine.gray_stack->top++)->as = el;
+    sparse_count = 0;
+    stats.compactions++;
 }
 
-void mark_value(Element el)
+static void finish_major(void)
 {
-    if (is_obj(el))
-        mark_obj(el);
+    /* roots are written without barriers, so rescan them */
+    mark_roots();
+    trace_references();
+
+    if (!pinning && (compact_requested || (tuning.compact && fragmented())))
+        compact();
+    marking = false;
+
+    prune_interns(true);
+    forget_all();
+
+    sweeping = true;
+    sweep_at = NULL;
+    sweep_nursery();
+
+    stats.majors++;
+    end_cycle();
+
+    TRACE(TRACE_GC_END, GC_MAJOR, machine.bytes_allocated);
 }
 
-static void mark_stack(Stack **s)
+static void set_next_gc(void)
 {
+    size_t live = machine.bytes_allocated;
+    double survival = major_start ? (double)live / major_start : 1.0;
 
-    PTR((*s) - 1)->mark = true;
+    if (survival > 1.0)
+        survival = 1.0;
+    stats.survival = survival;
 
-    // mark_obj(STK(*s));
-    Stack *p = NULL;
-    for (p = *s; p < p->top; p++)
-        mark_value(p->as);
+    size_t next = live + (size_t)(live * (tuning.growth - 1) * (0.5 + survival));
 
-    p = NULL;
+    if (tuning.heap_target && next > tuning.heap_target)
+        next = tuning.heap_target;
+    if (next < live + tuning.min_interval)
+        next = live + tuning.min_interval;
+
+    machine.next_gc = next;
 }
 
-static void mark_closure(Closure **c)
+static void trim_garbage(void)
 {
+    trim_requested = false;
 
-    PTR(*c)->mark = true;
-    PTR((*c)->func->name.as.String)->mark = true;
-    PTR((*c)->func->ch.cases.listof.Ints)->mark = true;
-    PTR((*c)->func->ch.lines.listof.Ints)->mark = true;
-    PTR((*c)->func->ch.op_codes.listof.Shorts)->mark = true;
-    PTR((*c)->func)->mark = true;
-
-    mark_stack(&(*c)->func->ch.constants);
+    /* a major under way keeps everything allocated since it began */
+    if (marking)
+    {
+        trace_references();
+        finish_major();
+    }
 
-    for (Upval **p = (*c)->upvals; p; p++)
-        mark_obj((*p)->closed.as);
+    sweep();
+    compact_requested = true;
+    begin_major();
+    trace_references();
+    finish_major();
+    sweep();
+    trim_heap(0);
 }
 
-static void mark_vector(Arena **vec)
+/* marks what the allocating code may still hold off the roots */
+static void pin_fresh(void)
 {
+    Free *page = NULL;
+
+    for (size_t i = 0; i < nursery_count; i++)
+        for (Free *block = nursery[i].start; block < nursery[i].end; block = NEXT_BLOCK(block))
+            if ((page = block_page(block)))
+                set_bit(mark_bits(page), bit_index(page, block));
 
-    int len = (*vec - 1)->count;
+    for (size_t i = 0; i < slab_young_count; i++)
+        if ((page = block_page(slab_young[i])))
+            set_bit(mark_bits(page), bit_index(page, slab_young[i]));
 
-    for (int i = 0; i < len; i++)
-        mark_value(OBJ((*vec)[i]));
+    for (int i = 0; i < FRESH_OLD; i++)
+        if (fresh_old[i] && (page = block_page(fresh_old[i])))
+            set_bit(mark_bits(page), bit_index(page, fresh_old[i]));
 }
 
-static void blacken_object(Element *el)
+/* a request past the heap limit collects on the spot, pinning fresh blocks */
+static void emergency_collect(void)
 {
-    if (_null(*el))
-        return;
+    pinning = true;
 
-    switch (el->type)
+    if (!marking)
     {
-    case TABLE:
-        mark_table(&el->table);
-        break;
-    case INSTANCE:
-        mark_table(&el->instance->fields);
-        break;
-    case VECTOR:
-        mark_vector(&el->arena_vector);
-        break;
-    case STACK:
-        mark_stack(&el->stack);
-        break;
-
-    default:
-        return;
+        sweep();
+        begin_major();
     }
+
+    trace_references();
+    pin_fresh();
+    finish_major();
+    sweep();
+    trim_heap(0);
+
+    pinning = false;
 }
 
-void mark_table(Table **t)
+static double now_us(void)
 {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e6 + ts.tv_nsec / 1e3;
+}
 
-    if (!((*t) - 1))
-        return;
-    Table *tab = *t;
+static void collect(Collection pass)
+{
+    if (trim_requested)
+    {
+        trim_garbage();
 
-    PTR((*t) - 1)->mark = true;
+        if (limit_pending)
+        {
+            limit_pending = false;
+            heap_full = heap_full || machine.bytes_allocated >= limit_mark();
+        }
+        return;
+    }
 
-    if ((tab - 1)->count == 0)
+    if (!marking && pass != GC_MAJOR)
+    {
+        collect_minor();
         return;
+    }
 
-    for (size_t i = 0; i < tab->size; i++)
-        if (tab[i].key.type != ARENA_NULL)
-        {
+    if (!marking)
+    {
+        sweep();
+        begin_major();
+    }
 
-            mark_obj(OBJ(tab[i].key));
-            // PTR(tab[i].key.as.String)->mark = true;
-            mark_value(tab[i].val);
-        }
+    if (trace_slice())
+        finish_major();
 }
 
-static void mark_class(Class *c)
+void collect_garbage(void)
 {
-    PTR(c)->mark = true;
-    PTR(c->name.as.String)->mark = true;
+    if (!machine.stack)
+        return;
 
-    if (c->init)
-        mark_closure(&c->init);
+    Collection pass = machine.gc_request;
+    machine.gc_request = GC_NONE;
 
-    // mark_table(&c->closures);
+    if (machine.dump_request)
+    {
+        char path[64];
+
+        machine.dump_request = 0;
+        snprintf(path, sizeof(path), "ykes-%d.heap", (int)getpid());
+        if (!heap_dump(path))
+            perror("Failed to write heap dump");
+        if (pass == GC_NONE)
+            pass = GC_MINOR;
+    }
+
+    double start = now_us();
+    collect(pass);
+    double pause = now_us() - start;
+
+    stats.pauses++;
+    stats.last_pause = pause;
+    stats.total_pause += pause;
+    if (pause > stats.max_pause)
+        stats.max_pause = pause;
 }
-static void mark_roots(void)
+
+/* true once per exhaustion, for the safepoint that fails the run */
+bool heap_exhausted(void)
 {
+    bool full = heap_full;
 
-    mark_stack(&machine.stack);
+    heap_full = false;
+    return full;
+}
 
-    Stack *p = NULL;
-    PTR(machine.call_stack - 1)->mark = true;
+GcStats gc_stats(void)
+{
+    GcStats s = stats;
 
-    for (p = machine.call_stack; p && p < p->top; p++)
-        mark_closure(&p->as.closure);
+    s.heap_size = heap_committed;
+    s.heap_limit = tuning.heap_limit;
+    s.bytes_allocated = machine.bytes_allocated;
+    s.next_gc = machine.next_gc;
 
-    p = NULL;
+    for (int i = 0; i < BIN_COUNT; i++)
+        for (Free *block = bins[i]; block; block = FREE_NEXT(block))
+        {
+            s.free_blocks++;
+            s.free_bytes += block->size;
+            if (block->size > s.largest_free)
+                s.largest_free = block->size;
+        }
 
-    PTR(machine.class_stack - 1)->mark = true;
-    for (p = machine.class_stack; p && p < p->top; p++)
-        mark_class(p->as.classc);
+    /* share of free memory a single request could not reach */
+    s.fragmentation = s.free_bytes
+                          ? 1.0 - (double)s.largest_free / s.free_bytes
+                          : 0.0;
+    return s;
+}
 
-    p = NULL;
+void print_gc_stats(void)
+{
+    GcStats s = gc_stats();
+
+    fprintf(stderr, "-- gc stats\n");
+    fprintf(stderr, "collections:   %zu minor, %zu major\n", s.minors, s.majors);
+    fprintf(stderr, "pauses:        %zu, total %.0f us, max %.0f us, last %.0f us\n",
+            s.pauses, s.total_pause, s.max_pause, s.last_pause);
+    fprintf(stderr, "marked:        %zu bytes, last cycle %zu bytes\n", s.marked, s.last_marked);
+    fprintf(stderr, "freed:         %zu bytes\n", s.freed);
+    fprintf(stderr, "compactions:   %zu, %zu bytes moved\n", s.compactions, s.moved);
+    fprintf(stderr, "heap:          %zu bytes, %zu allocated, next gc at %zu\n",
+            s.heap_size, s.bytes_allocated, s.next_gc);
+    if (s.heap_limit)
+        fprintf(stderr, "heap limit:    %zu bytes, %.1f%% used\n",
+                s.heap_limit, 100.0 * s.heap_size / s.heap_limit);
+    fprintf(stderr, "survival:      %.1f%% of the heap at the last major\n", s.survival * 100);
+    fprintf(stderr, "free list:     %zu bytes in %zu blocks, largest %zu, %.1f%% fragmented\n",
+            s.free_bytes, s.free_blocks, s.largest_free, s.fragmentation * 100);
+}
 
-    PTR(machine.native_calls - 1)->mark = true;
-    for (p = machine.native_calls; p && p < p->top; p++)
-        PTR(p->as.native)->mark = true;
+size_t hash_ptr(uintptr_t key)
+{
+    key ^= key >> 33;
+    key *= 0xff51afd7ed558ccdULL;
+    key ^= key >> 33;
+    return (size_t)key;
+}
 
-    p = NULL;
-    mark_table(&machine.glob);
+void free_garbage(void)
+{
 }
 
-static void trace_references(void)
+static void sweep_page(void)
 {
+    size_t lo = 0, hi = page_count;
 
-    while (machine.gray_stack->count > 0)
+    while (lo < hi)
     {
-        Element el = machine.gray_stack[--machine.gray_stack->count].as;
-        blacken_object(&el);
-    }
+        size_t mid = lo + (hi - lo) / 2;
 
-    machine.gray_stack->top = machine.gray_stack;
-}
+        if ((char *)pages[mid] < sweep_at)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
 
-void collect_garbage(void)
-{
-#ifdef DEBUG_LOG_GC
-    printf("-- gc begin\n");
-#endif
+    if (lo == page_count)
+    {
+        sweeping = false;
+        sweep_at = NULL;
+        set_next_gc();
 
-    if (!machine.stack)
+        if (heap_committed > machine.bytes_allocated * HEAP_TRIM_HIGH + INIT_GLOBAL)
+            trim_heap(machine.bytes_allocated * HEAP_TRIM_LOW + INIT_GLOBAL);
         return;
-    mark_roots();
-    trace_references();
-    sweep();
+    }
 
-    machine.next_gc = machine.bytes_allocated * INC;
+    Free *page = pages[lo];
+    uint64_t *alloc = alloc_bits(page), *mark = mark_bits(page);
+    size_t words = page_words(page);
 
-    machine.gc_work_list = NULL;
-    machine.gc_work_list_head = NULL;
+    sweep_at = (char *)page + page->size;
 
-#ifdef DEBUG_LOG_GC
-    printf("-- gc end\n");
-#endif
-}
+    for (size_t w = 0; w < words; w++)
+    {
+        uint64_t dead = alloc[w] & ~mark[w];
+        mark[w] = 0;
 
-void free_garbage(void)
-{
+        for (; dead; dead &= dead - 1)
+        {
+            size_t bit = w * 64 + __builtin_ctzll(dead);
+            Free *block = (Free *)((char *)page + bit * ALIGNMENT);
+
+            if (block->perm || block->young)
+                continue;
+
+            stats.freed += block->size;
+            FREE(block);
+        }
+    }
 }
 
 void sweep(void)
 {
+    while (sweeping)
+        sweep_page();
+}
 
-    Free *free = NULL, *prev = NULL;
-
-    for (free = machine.gc_work_list; free; free = free->next)
-    {
-        prev = free;
+/* each trip to the bins pays for one page of the lazy sweep */
+static Free *take_block(size_t size)
+{
+    Free *block = NULL;
 
-        if (!prev->mark)
-        {
-            Free *garbage = free;
+    if (sweeping)
+        sweep_page();
 
-            if (free == machine.gc_work_list)
-                machine.gc_work_list = free->next;
-            else
-                prev = free->next;
+    while (!(block = find_block(size)) && sweeping)
+        sweep_page();
 
-            FREE(garbage);
-        }
-        else
-            prev->mark = false;
-    }
+    return block ? block : request_page(size);
 }
 
 void free_ptr(Free *new)
 {
 
-    if (!new)
-        return;
-    if (new->size == 0)
+    Free *page = NULL;
+
+    /* natives hand back strings the heap never allocated */
+    if (!new || !(page = block_page(new)))
         return;
 
-#ifdef DEBUG_LOG_GC
-    printf("FREE: %p\n", (void *)new);
-#endif
+    TRACE(TRACE_FREE, new + 1, new->size);
+
+    machine.bytes_allocated -= new->size;
 
-    Free *free = NULL, *prev = NULL;
+    clear_bit(alloc_bits(page), bit_index(page, new));
+    clear_bit(mark_bits(page), bit_index(page, new));
 
-    if (!mem)
+    if (test_bit(gray_bits(page), bit_index(page, new)))
+        drop_obj(machine.gray_stack, new);
+    clear_bit(gray_bits(page), bit_index(page, new));
+
+    /* the nursery reclaims young blocks wholesale at the next minor */
+    if (new->young)
     {
-        mem = new;
-        mem->next = NULL;
-        mem->mark = false;
+        new->free = true;
         return;
     }
 
-    for (free = mem; free->next && (((unsigned long)free < (unsigned long)new)); free = free->next)
-        prev = free->next;
+    if (new->remembered)
+        forget_obj(new);
 
-    if (free && free < new)
+    if (new->slab)
     {
-        new->next = free->next;
-        free->next = new;
+        slab_push(new);
+        return;
     }
-    else if (prev && prev < new)
+
+    if (is_large(page))
     {
-        new->next = prev->next;
-        prev->next = new;
+        release_large(page);
+        return;
     }
 
-    merge_list();
+    /* a header swallowed by coalesce must still read as free */
+    new->free = true;
+    bin_push(coalesce(new));
     new = NULL;
-    prev = NULL;
-    free = NULL;
 }
 
-void append_obj(Free *alloced)
+static void request_gc(Collection pass)
 {
+    if (machine.collect && machine.gc_request < pass)
+        machine.gc_request = pass;
+}
 
-    if (!alloced)
-        return;
-
-    Free *ptr = NULL;
+/* the collection itself waits for the next safepoint */
+void gc_trim(void)
+{
+    trim_requested = true;
+    request_gc(GC_MAJOR);
+}
 
-    ptr = alloced;
+static Free *nursery_chunk(void)
+{
+    Free *chunk = take_block(NURSERY_SIZE);
 
-    if (!machine.gc_work_list)
-        machine.gc_work_list = ptr;
+    split_block(chunk, NURSERY_SIZE);
 
-    else if (!machine.gc_work_list_head)
+    if (nursery_count + 1 > nursery_len)
     {
-        machine.gc_work_list->next = ptr;
-        machine.gc_work_list_head = machine.gc_work_list->next;
+        nursery_len = GROW_CAPACITY(nursery_len);
+        nursery = realloc(nursery, nursery_len * sizeof(Nursery));
+
+        if (!nursery)
+        {
+            perror("Failed to reallocate nursery.");
+            exit(1);
+        }
     }
+
+    if (nursery_count > 0 && !marking)
+        request_gc(GC_MINOR);
+
+    nursery[nursery_count].page = page_of(chunk);
+    nursery[nursery_count].start = chunk;
+    nursery[nursery_count++].end = NEXT_BLOCK(chunk);
+
+    chunk->young = true;
+    chunk->free = true;
+    return chunk;
+}
+
+/* near the limit a fresh chunk would cost a whole page, so go old */
+static bool nursery_fits(size_t size)
+{
+    if (bump && bump->size >= size)
+        return true;
+
+    return !tuning.heap_limit ||
+           heap_committed + page_fit(NURSERY_SIZE) < limit_mark();
+}
+
+static Free *nursery_alloc(size_t size)
+{
+    if (!bump || bump->size < size)
+        bump = nursery_chunk();
+
+    Free *block = bump;
+
+    if (block->size - size < MIN_BLOCK)
+        bump = NULL;
     else
     {
-        ptr = machine.gc_work_list_head;
-        machine.gc_work_list_head = machine.gc_work_list_head->next;
-        machine.gc_work_list_head = alloced;
-        ptr->next = alloced;
+        Free *tail = (Free *)((char *)block + size);
+        tail->size = block->size - size;
+        tail->young = true;
+        tail->free = true;
+        tail->prev_free = false;
+        tail->slab = 0;
+        block->size = size;
+        bump = tail;
+    }
+
+    block->free = false;
+    return block;
+}
+
+static void *region_alloc(size_t size)
+{
+    if (!region || region->used + size > region->size)
+    {
+        size_t len = ALIGN(sizeof(Region)) + size;
+        Region *chunk = NULL;
+
+        if (len < REGION_CHUNK)
+            len = REGION_CHUNK;
+
+        if (!(chunk = malloc(len)))
+        {
+            perror("Failed to allocate compiler region.");
+            exit(1);
+        }
+
+        chunk->next = region;
+        chunk->used = ALIGN(sizeof(Region));
+        chunk->size = len;
+        region = chunk;
     }
+
+    Free *block = (Free *)((char *)region + region->used);
+    region->used += size;
+
+    memset(block, 0, size);
+    block->size = size;
+    block->perm = true;
+    return block + 1;
+}
+
+void region_enter(void)
+{
+    region_depth++;
+}
+
+void region_leave(void)
+{
+    region_depth--;
 }
-static void _init_free_ptr(Free **ptr, size_t alloc_size, size_t new_size)
+
+void region_free(void)
 {
-    (*ptr)->next = request_system_memory(alloc_size);
-    (*ptr)->next->size = alloc_size - OFFSET - new_size;
-    (*ptr)->next->next = NULL;
+    while (region)
+    {
+        Region *next = region->next;
+        free(region);
+        region = next;
+    }
+    region_depth = 0;
 }
 
 static void *_init_alloced_ptr(void *ptr, size_t size)
 {
-    Free *alloced = NULL;
+    Free *alloced = NULL, *page = NULL;
     alloced = ptr;
-    alloced->next = NULL;
+    page = page_of(alloced);
     alloced->size = size;
-    alloced->mark = false;
-    append_obj(alloced);
+    alloced->free = false;
+    alloced->remembered = false;
+    alloced->moved = false;
+    alloced->perm = !machine.collect;
+
+    /* recycled blocks must look like fresh pages to callers */
+    if (!is_large(page))
+        memset(alloced + 1, 0, size - OFFSET);
+
+    set_bit(alloc_bits(page), bit_index(page, alloced));
+    clear_bit(gray_bits(page), bit_index(page, alloced));
+    /* allocated black while a major is marking or ahead of the sweep */
+    if (marking || (!alloced->young && unswept(alloced)))
+        set_bit(mark_bits(page), bit_index(page, alloced));
     return 1 + alloced;
 }
 
 void *alloc_ptr(size_t size)
 {
 
-    Free *prev = NULL;
-    Free *free = NULL;
+    Free *block = NULL;
     void *alloced = NULL;
 
-    if (!mem)
-        reinitialize_free_list();
+    size = ALIGN(size);
+    if (size < MIN_BLOCK)
+        size = MIN_BLOCK;
 
-    machine.bytes_allocated += size;
+    if (region_depth)
+        return region_alloc(size);
+
+    if (machine.collect && size <= NURSERY_MAX && nursery_fits(size))
+        block = nursery_alloc(size);
+    else if (size >= LARGE_MIN)
+        block = large_alloc(size);
+    else
+    {
+        block = take_block(size);
+        split_block(block, size);
+        block->young = false;
+    }
+
+    if (!block->young)
+        fresh_old[fresh_at++ % FRESH_OLD] = block;
+
+    machine.bytes_allocated += block->size;
 
 #ifdef DEBUG_STRESS_GC
-    collect_garbage();
-#else
-    if (machine.bytes_allocated > machine.next_gc)
-        collect_garbage();
+    request_gc(GC_MINOR);
 #endif
+    if (marking || (!sweeping && machine.bytes_allocated > machine.next_gc))
+        request_gc(GC_MAJOR);
+
+    alloced = _init_alloced_ptr(block, block->size);
+
+    if (machine.profile)
+        profile_alloc(block);
+
+    TRACE(TRACE_ALLOC, alloced, block->size);
+
+    return alloced;
+}
+
+/* mremaps a large block, or NULL for the caller to copy */
+static void *large_realloc(Free *block, size_t size)
+{
+    Free *page = NULL;
+
+    if (!block || !(page = block_page(block)) || !is_large(page))
+        return NULL;
+
+    size = ALIGN(size + OFFSET);
+    if (size < LARGE_MIN)
+        return NULL;
+
+    size_t region = LARGE_REGION(size);
+
+    if (region == page->size)
+        return block + 1;
+
+    if (test_bit(gray_bits(page), bit_index(page, block)))
+        drop_obj(machine.gray_stack, block);
+    set_gray(page, block, false);
+
+    if (block->remembered)
+        forget_obj(block);
+
+    size_t old = page->size;
+    Free *from = block;
+
+    if (region > old)
+        check_limit(region - old);
+    remove_page(page_slot(page));
+
+    page = mremap(page, old, region, MREMAP_MAYMOVE);
 
-    for (free = mem; free && free->size < size; free = free->next)
-        prev = free;
+    if (page == MAP_FAILED)
+    {
+        perror("Failed to remap large object");
+        exit(1);
+    }
+
+    page->size = region;
+    heap_committed += region;
+    insert_page(page);
+    large_fence(page);
 
-    if (free && free->size >= size)
+    block = (Free *)((char *)page + page_meta(page));
+    machine.bytes_allocated -= block->size;
+    block = large_block(page);
+    machine.bytes_allocated += block->size;
+
+    if (machine.profile)
+        profile_move(from, block);
+
+    if (!marking)
     {
+        if (unswept(block))
+            set_bit(mark_bits(page), bit_index(page, block));
+        else
+            clear_bit(mark_bits(page), bit_index(page, block));
+    }
 
-        free->size -= size;
+    return block + 1;
+}
+
+/* carves a run into blocks of the slab's size, the last taking the slack */
+static void slab_refill(SlabKind kind)
+{
+    Slab *slab = &slabs[kind];
+    Free *run = take_block(SLAB_SIZE);
 
-        if (prev && free->size == 0)
-            prev->next = free->next;
-        else if (!prev && free->size == 0)
-            mem = free->next;
+    split_block(run, SLAB_SIZE);
 
-        alloced = _init_alloced_ptr((char *)(free + 1) + free->size, size - OFFSET);
-#ifdef DEBUG_LOG_GC
-        printf("ALLOCED: %p, SIZE: %zu\n", alloced, size);
-#endif
+    size_t n = run->size / slab->size;
+    size_t slack = run->size - n * slab->size;
+    char *at = (char *)run + (n - 1) * slab->size;
 
-        return alloced;
+    for (size_t i = n; i-- > 0; at -= slab->size)
+    {
+        Free *block = (Free *)at;
+        block->size = slab->size + (i == n - 1 ? slack : 0);
+        block->prev_free = false;
+        block->slab = kind + 1;
+        slab_push(block);
     }
+}
+
+static void *slab_alloc(SlabKind kind)
+{
+    Slab *slab = &slabs[kind];
 
-    if (prev)
+    if (!slab->free)
+        slab_refill(kind);
+
+    Free *block = slab->free;
+    slab->free = FREE_NEXT(block);
+
+    block->young = machine.collect;
+
+    if (block->young)
     {
-        size_t tmp = PAGE;
-        while (size > tmp)
-            tmp *= INC;
+        if (slab_young_count + 1 > slab_young_len)
+        {
+            slab_young_len = GROW_CAPACITY(slab_young_len);
+            slab_young = realloc(slab_young, slab_young_len * sizeof(Free *));
+
+            if (!slab_young)
+            {
+                perror("Failed to reallocate slab young list.");
+                exit(1);
+            }
+        }
+        slab_young[slab_young_count++] = block;
 
-        _init_free_ptr(&prev, tmp, size);
+        if (slab_young_count >= SLAB_YOUNG_MAX && !marking)
+            request_gc(GC_MINOR);
+    }
 
-        alloced = _init_alloced_ptr((char *)(prev->next + 1) + prev->next->size, size - OFFSET);
+    machine.bytes_allocated += block->size;
 
-#ifdef DEBUG_LOG_GC
-        printf("ALLOCED: %p, SIZE: %zu\n", (void *)alloced, size);
+#ifdef DEBUG_STRESS_GC
+    request_gc(GC_MINOR);
 #endif
+    if (marking || (!sweeping && machine.bytes_allocated > machine.next_gc))
+        request_gc(GC_MAJOR);
 
-        return alloced;
-    }
+    void *alloced = _init_alloced_ptr(block, block->size);
 
-    return NULL;
+    if (machine.profile)
+        profile_alloc(block);
+
+    TRACE(TRACE_ALLOC, alloced, block->size);
+    return alloced;
 }
 
 Arena *arena_alloc_arena(size_t size)
@@ -775,16 +3067,23 @@ Arena *arena_realloc_arena(Arena *ar, size_t size)
     {
         if (!ar)
             return NULL;
-        machine.bytes_allocated -= (ar - 1)->size;
         arena_free_arena(ar);
         --ar;
         ar = NULL;
         return NULL;
     }
 
+    /* a large vector grows where it lies */
+    if ((ptr = large_realloc(PTR((ar - 1)), (size * sizeof(Arena)) + sizeof(Arena))))
+    {
+        ptr->size = size;
+        ptr->len = (int)size;
+        WRITE_BARRIER(VECT(ptr + 1));
+        return ptr + 1;
+    }
+
     ptr = arena_alloc_arena(size);
 
-    machine.bytes_allocated -= (ar - 1)->size;
 
     if (size > (ar - 1)->size)
         new_size = (ar - 1)->size;
@@ -795,6 +3094,7 @@ Arena *arena_realloc_arena(Arena *ar, size_t size)
         ptr[i] = ar[i];
 
     (ptr - 1)->count = (ar - 1)->count;
+    WRITE_BARRIER(VECT(ptr));
 
     FREE(PTR((ar - 1)));
     --ar;
@@ -807,7 +3107,6 @@ void arena_free_arena(Arena *ar)
     if (!(ar - 1))
         return;
 
-    machine.bytes_allocated -= (ar - 1)->size;
 
     if ((ar - 1)->count == 0)
     {
@@ -830,7 +3129,6 @@ void arena_free_arena(Arena *ar)
         case ARENA_FUNC:
         case ARENA_NATIVE:
         case ARENA_VAR:
-            machine.bytes_allocated -= ar[i].size;
             ARENA_FREE(&ar[i]);
             break;
         default:
@@ -857,26 +3155,41 @@ Arena arena_realloc(Arena *ar, size_t size, T type)
     {
         if (ar->type == ARENA_NULL)
             return Null();
-        machine.bytes_allocated -= ar->size;
 
         ARENA_FREE(ar);
         return Null();
     }
 
     void *ptr = NULL;
+
+    /* a large payload grows where it lies; string slots are copied */
+    if (ar && ar->type == type && type != ARENA_STRS &&
+        (ptr = large_realloc(obj_block(OBJ(*ar)), size)))
+    {
+        Arena a = arena_init(ptr, size, type);
+        a.count = (ar->count > a.len)
+                      ? a.len
+                      : ar->count;
+        return a;
+    }
+
     ptr = ALLOC(size);
 
     if (!ar && size != 0)
         return arena_init(ptr, size, type);
 
-    machine.bytes_allocated -= ar->size;
     size_t new_size = 0;
+    Free *old = obj_block(OBJ(*ar));
 
     if (size > ar->size)
         new_size = ar->size;
     else
         new_size = size;
 
+    /* callers may already have set size to the grown one; read no further than the old block */
+    if (old && block_page(old) && new_size > old->size - OFFSET)
+        new_size = old->size - OFFSET;
+
     switch (type)
     {
     case ARENA_BYTES:
@@ -894,9 +3207,9 @@ Arena arena_realloc(Arena *ar, size_t size, T type)
     case ARENA_VAR:
     case ARENA_FUNC:
     case ARENA_NATIVE:
-        if (!ar->as.String)
+        if (!ar->small && !ar->as.String)
             return arena_init(ptr, size, type);
-        memcpy(ptr, ar->as.String, new_size);
+        memcpy(ptr, STR(*ar), new_size);
         break;
     case ARENA_INTS:
         if (!ar->listof.Ints)
@@ -920,8 +3233,9 @@ Arena arena_realloc(Arena *ar, size_t size, T type)
         if (!ar->listof.Strings || ar->type == ARENA_NULL)
             return arena_init(ptr, size, type);
         Arena str = arena_init(ptr, size, type);
-        for (size_t i = 0; i < new_size; i++)
+        for (size_t i = 0; i < new_size / sizeof(char *) && ar->listof.Strings[i]; i++)
             str.listof.Strings[i] = CString(ar->listof.Strings[i]).as.String;
+        WRITE_BARRIER(OBJ(str));
     }
     break;
 
@@ -944,6 +3258,12 @@ Element cpy_array(Element el)
     size_t size = ar.size;
     int len = ar.count;
 
+    /* a small string is copied by being passed by value */
+    if (is_string(type) && ar.small)
+        return el;
+    if (is_string(type) && ar.grown)
+        return OBJ(spill_string(ar));
+
     void *ptr = NULL;
     ptr = ALLOC(size);
 
@@ -987,6 +3307,7 @@ Element cpy_array(Element el)
         Arena str = arena_init(ptr, size, type);
         for (int i = 0; i < len; i++)
             str.listof.Strings[i] = CString(ar.listof.Strings[i]).as.String;
+        WRITE_BARRIER(OBJ(str));
     }
     break;
 
@@ -1003,7 +3324,7 @@ Element cpy_array(Element el)
 
 Arena Char(char Char)
 {
-    Arena ar;
+    Arena ar = {0};
     ar.type = ARENA_CHAR;
     ar.as.Char = Char;
     ar.size = sizeof(char);
@@ -1013,7 +3334,7 @@ Arena Char(char Char)
 }
 Arena Int(int Int)
 {
-    Arena ar;
+    Arena ar = {0};
     ar.type = ARENA_INT;
     ar.as.Int = Int;
     ar.size = sizeof(int);
@@ -1022,7 +3343,7 @@ Arena Int(int Int)
 }
 Arena Byte(uint8_t Byte)
 {
-    Arena ar;
+    Arena ar = {0};
     ar.type = ARENA_BYTE;
     ar.as.Byte = Byte;
     ar.size = sizeof(uint8_t);
@@ -1030,7 +3351,7 @@ Arena Byte(uint8_t Byte)
 }
 Arena Long(long long int Long)
 {
-    Arena ar;
+    Arena ar = {0};
     ar.type = ARENA_LONG;
     ar.as.Long = Long;
     ar.size = sizeof(long long int);
@@ -1040,7 +3361,7 @@ Arena Long(long long int Long)
 }
 Arena Double(double Double)
 {
-    Arena ar;
+    Arena ar = {0};
     ar.type = ARENA_DOUBLE;
     ar.as.Double = Double;
     ar.size = sizeof(double);
@@ -1050,14 +3371,7 @@ Arena Double(double Double)
 }
 Arena String(const char *str)
 {
-    size_t size = strlen(str);
-    Arena ar = arena_alloc(size, ARENA_STR);
-    memcpy(ar.as.String, str, size);
-    ar.as.String[size] = '\0';
-    ar.size = size;
-    long long int k = hash(ar);
-    ar.as.hash = k;
-    return ar;
+    return intern_string(str, ARENA_STR);
 }
 Arena CString(const char *str)
 {
@@ -1066,6 +3380,9 @@ Arena CString(const char *str)
     ar.as.String = (char *)str;
     // ar.as.String[size - 1] = '\0';
     ar.size = size;
+    ar.small = 0;
+    ar.grown = 0;
+    ar.interned = 0;
     ar.type = ARENA_CSTR;
     ar.as.len = (int)size;
     long long int k = hash(ar);
@@ -1075,7 +3392,7 @@ Arena CString(const char *str)
 
 Arena Bool(bool Bool)
 {
-    Arena ar;
+    Arena ar = {0};
     ar.type = ARENA_BOOL;
     ar.as.Bool = Bool;
     ar.size = sizeof(bool);
@@ -1083,7 +3400,7 @@ Arena Bool(bool Bool)
 }
 Arena Size(size_t Size)
 {
-    Arena ar;
+    Arena ar = {0};
     ar.type = ARENA_SIZE;
     ar.as.Size = Size;
     ar.size = 1;
@@ -1095,6 +3412,9 @@ Arena Null(void)
 {
     Arena ar;
     ar.type = ARENA_NULL;
+    ar.small = 0;
+    ar.grown = 0;
+    ar.interned = 0;
     ar.as.Void = NULL;
     return ar;
 }
@@ -1140,6 +3460,7 @@ void push_arena(Element *el, Arena ar)
     }
 
     el->arena_vector[(el->arena_vector - 1)->count++] = ar;
+    WRITE_BARRIER(*el);
 }
 
 Element pop_arena(Element *el)
@@ -1213,6 +3534,7 @@ void push_string(Element *el, const char *String)
         el->arena = GROW_ARRAY(&el->arena, el->arena.size, ARENA_STRS);
     }
     el->arena.listof.Strings[el->arena.count++] = (char *)String;
+    WRITE_BARRIER(*el);
 }
 Element pop_string(Element *el)
 {
@@ -1225,7 +3547,7 @@ Element pop_string(Element *el)
 Class *class(Arena name)
 {
     Class *c = NULL;
-    c = ALLOC(sizeof(Class));
+    c = slab_alloc(SLAB_CLASS);
     c->name = name;
     c->closures = NULL;
     c->init = NULL;
@@ -1237,22 +3559,21 @@ void free_class(Class *c)
 
     ARENA_FREE(&c->name);
     arena_free_table(c->closures);
-    machine.bytes_allocated -= sizeof(Class);
     FREE(PTR(c));
 }
 
 Instance *instance(Class *classc)
 {
     Instance *ic = NULL;
-    ic = ALLOC(sizeof(Instance));
+    ic = slab_alloc(SLAB_INSTANCE);
     ic->classc = classc;
     ic->fields = NULL;
     return ic;
 }
 void free_instance(Instance *ic)
 {
-    FREE(PTR(ic));
     arena_free_table(ic->fields);
+    FREE(PTR(ic));
     ic = NULL;
 }
 
@@ -1274,7 +3595,6 @@ Stack *realloc_stack(Stack *st, size_t size)
     {
         if (!st)
             return NULL;
-        machine.bytes_allocated -= (st - 1)->size;
         FREE_STACK(&st);
         --st;
         st = NULL;
@@ -1286,7 +3606,6 @@ Stack *realloc_stack(Stack *st, size_t size)
     if (!st)
         return s;
 
-    machine.bytes_allocated -= (st - 1)->size;
 
     size_t new_size = 0;
     if (size > (st - 1)->size)
@@ -1300,6 +3619,7 @@ Stack *realloc_stack(Stack *st, size_t size)
     s->count = st->count;
     s->top = s;
     s->top += st->count;
+    WRITE_BARRIER(STK(s));
     // FREE(PTR((st - 1)));
     --st;
     st = NULL;
@@ -1483,7 +3803,7 @@ Element null_obj(void)
 
 Function *function(Arena name)
 {
-    Function *func = ALLOC(sizeof(Function));
+    Function *func = slab_alloc(SLAB_FUNCTION);
     func->arity = 0;
     func->upvalue_count = 0;
     func->name = name;
@@ -1506,7 +3826,7 @@ void free_function(Function *func)
 Native *native(NativeFn func, Arena ar)
 {
     Native *native = NULL;
-    native = ALLOC(sizeof(Native));
+    native = slab_alloc(SLAB_NATIVE);
     native->fn = func;
     native->obj = ar;
     return native;
@@ -1517,7 +3837,6 @@ void free_native(Native *native)
 
     if (!native)
         return;
-    machine.bytes_allocated -= sizeof(Native);
 
     ARENA_FREE(&native->obj);
     FREE(PTR(native));
@@ -1526,7 +3845,7 @@ void free_native(Native *native)
 Closure *new_closure(Function *func)
 {
     Closure *closure = NULL;
-    closure = ALLOC(sizeof(Closure));
+    closure = slab_alloc(SLAB_CLOSURE);
     closure->func = func;
     if (!func)
     {
@@ -1547,7 +3866,6 @@ void free_closure(Closure **closure)
     if (!(*closure))
         return;
 
-    machine.bytes_allocated -= sizeof(Closure);
 
     FREE_UPVALS((*closure)->upvals);
     FREE(PTR(*closure));
@@ -1555,10 +3873,10 @@ void free_closure(Closure **closure)
     closure = NULL;
 }
 
-Upval *upval(Stack *index)
+Upval *upval(Element *index)
 {
     Upval *up = NULL;
-    up = ALLOC(sizeof(Upval));
+    up = slab_alloc(SLAB_UPVAL);
     up->index = index;
     up->closed = *index;
     up->next = NULL;
@@ -1613,7 +3931,6 @@ void arena_free_table(Table *t)
 
     size_t size = (t - 1)->size;
 
-    machine.bytes_allocated -= (t - 1)->size;
 
     if ((t - 1)->count == 0)
     {
@@ -1656,37 +3973,16 @@ void arena_free_entry(Table *entry)
 
 Arena Var(const char *str)
 {
-    size_t size = strlen(str);
-    Arena ar = GROW_ARRAY(NULL, size, ARENA_VAR);
-    memcpy(ar.as.String, str, size);
-    ar.as.String[size] = '\0';
-    size_t h = hash(ar);
-    ar.as.hash = h;
-    ar.type = ARENA_VAR;
-    return ar;
+    return intern_string(str, ARENA_VAR);
 }
 
 Arena func_name(const char *str)
 {
-    size_t size = strlen(str);
-    Arena ar = GROW_ARRAY(NULL, size, ARENA_FUNC);
-    memcpy(ar.as.String, str, size);
-    ar.as.String[size] = '\0';
-    size_t h = hash(ar);
-    ar.as.hash = h;
-    ar.type = ARENA_FUNC;
-    return ar;
+    return intern_string(str, ARENA_FUNC);
 }
 Arena native_name(const char *str)
 {
-    size_t size = strlen(str);
-    Arena ar = GROW_ARRAY(NULL, size, ARENA_NATIVE);
-    memcpy(ar.as.String, str, size);
-    ar.as.String[size] = '\0';
-    size_t h = hash(ar);
-    ar.as.hash = h;
-    ar.type = ARENA_NATIVE;
-    return ar;
+    return intern_string(str, ARENA_NATIVE);
 }
 
 long long int hash(Arena key)
@@ -1700,12 +3996,17 @@ long long int hash(Arena key)
     case ARENA_STR:
     case ARENA_CSTR:
     case ARENA_NATIVE:
-        for (char *s = key.as.String; *s; s++)
+    {
+        size_t len = 0;
+        const char *s = str_bytes(&key, &len);
+
+        for (size_t i = 0; i < len; i++)
         {
-            index ^= (int)*s;
+            index ^= (int)s[i];
             index *= 16777619;
         }
         break;
+    }
     case ARENA_INT:
         index ^= key.as.Int;
         index = (index * 16777669);
@@ -1749,24 +4050,24 @@ void print(Element ar)
 
     if (ar.type == NATIVE)
     {
-        printf("<native: %s>", ar.native->obj.as.String);
+        printf("<native: %s>", STR(ar.native->obj));
         return;
     }
     if (ar.type == CLOSURE)
     {
-        printf("<fn: %s>", ar.closure->func->name.as.String);
+        printf("<fn: %s>", STR(ar.closure->func->name));
         return;
     }
     if (ar.type == CLASS)
     {
-        printf("<class: %s>", ar.classc->name.as.String);
+        printf("<class: %s>", STR(ar.classc->name));
         return;
     }
     if (ar.type == INSTANCE)
     {
         if (!ar.instance->classc)
             return;
-        printf("<instance: %s>", ar.instance->classc->name.as.String);
+        printf("<instance: %s>", STR(ar.instance->classc->name));
         return;
     }
     if (ar.type == VECTOR)
@@ -1828,7 +4129,7 @@ void print(Element ar)
     case ARENA_VAR:
     case ARENA_FUNC:
     case ARENA_CSTR:
-        parse_str(a.as.String);
+        parse_str(STR(a));
         break;
     case ARENA_INTS:
         printf("[ ");
@@ -1868,26 +4169,26 @@ void print_line(Element ar)
 
     if (ar.type == NATIVE)
     {
-        printf("<native: %s>\n", ar.native->obj.as.String);
+        printf("<native: %s>\n", STR(ar.native->obj));
         return;
     }
     if (ar.type == CLOSURE)
     {
-        printf("<fn: %s>\n", ar.closure->func->name.as.String);
+        printf("<fn: %s>\n", STR(ar.closure->func->name));
         return;
     }
     if (ar.type == CLASS)
     {
         if (!ar.classc)
             return;
-        printf("<class: %s>\n", ar.classc->name.as.String);
+        printf("<class: %s>\n", STR(ar.classc->name));
         return;
     }
     if (ar.type == INSTANCE)
     {
         if (!ar.instance->classc)
             return;
-        printf("<instance: %s>\n", ar.instance->classc->name.as.String);
+        printf("<instance: %s>\n", STR(ar.instance->classc->name));
         return;
     }
     if (ar.type == VECTOR)
@@ -1960,7 +4261,7 @@ void print_line(Element ar)
     case ARENA_VAR:
     case ARENA_FUNC:
     case ARENA_CSTR:
-        parse_str(a.as.String);
+        parse_str(STR(a));
         printf("\n");
         break;
     case ARENA_INTS:
@@ -0,0 +1,227 @@
+#include "arena_memory.h"
+#include "virtual_machine.h"
+#include <stdio.h>
+#include <stdlib.h>
+
+/**
+    --profile charges each allocation to the function, opcode and line
+    that made it; owners maps a live block back to its site.
+*/
+typedef struct
+{
+    Function *func;
+    int op;
+    int line;
+    size_t count;
+    size_t bytes;
+    size_t live;
+} Site;
+
+typedef struct
+{
+    Free *block;
+    size_t site;
+} Owner;
+
+static Site *sites;
+static size_t site_count;
+static size_t *site_slots;
+static size_t site_cap;
+static Owner *owners;
+static size_t owner_count;
+static size_t owner_cap;
+
+static size_t site_hash(Function *func, int op, int line)
+{
+    return hash_ptr((uintptr_t)func ^ ((uintptr_t)op << 48) ^ (uintptr_t)line);
+}
+
+/* slots hold a site index plus one, 0 for empty */
+static void grow_sites(void)
+{
+    site_cap = site_cap ? site_cap * INC : CAPACITY;
+    free(site_slots);
+    site_slots = calloc(site_cap, sizeof(size_t));
+    sites = realloc(sites, (site_cap / INC) * sizeof(Site));
+
+    if (!site_slots || !sites)
+    {
+        perror("Failed to reallocate allocation sites.");
+        exit(1);
+    }
+
+    for (size_t i = 0; i < site_count; i++)
+    {
+        size_t h = site_hash(sites[i].func, sites[i].op, sites[i].line) & (site_cap - 1);
+        while (site_slots[h])
+            h = (h + 1) & (site_cap - 1);
+        site_slots[h] = i + 1;
+    }
+}
+
+static size_t find_site(Function *func, int op, int line)
+{
+    if ((site_count + 1) * INC > site_cap)
+        grow_sites();
+
+    size_t h = site_hash(func, op, line) & (site_cap - 1);
+
+    for (; site_slots[h]; h = (h + 1) & (site_cap - 1))
+    {
+        Site *s = &sites[site_slots[h] - 1];
+        if (s->func == func && s->op == op && s->line == line)
+            return site_slots[h] - 1;
+    }
+
+    sites[site_count] = (Site){func, op, line, 0, 0, 0};
+    site_slots[h] = ++site_count;
+    return site_count - 1;
+}
+
+static void set_owner(Free *block, size_t site);
+
+static void grow_owners(void)
+{
+    Owner *old = owners;
+    size_t cap = owner_cap;
+
+    owner_cap = owner_cap ? owner_cap * INC : CAPACITY;
+    owners = calloc(owner_cap, sizeof(Owner));
+
+    if (!owners)
+    {
+        perror("Failed to reallocate allocation owners.");
+        exit(1);
+    }
+
+    owner_count = 0;
+    for (size_t i = 0; i < cap; i++)
+        if (old[i].block)
+            set_owner(old[i].block, old[i].site);
+    free(old);
+}
+
+static Owner *find_owner(Free *block)
+{
+    size_t h = hash_ptr((uintptr_t)block) & (owner_cap - 1);
+
+    while (owners[h].block && owners[h].block != block)
+        h = (h + 1) & (owner_cap - 1);
+    return &owners[h];
+}
+
+static void set_owner(Free *block, size_t site)
+{
+    if ((owner_count + 1) * INC > owner_cap)
+        grow_owners();
+
+    Owner *o = find_owner(block);
+
+    if (!o->block)
+        owner_count++;
+    o->block = block;
+    o->site = site;
+}
+
+void profile_alloc(Free *block)
+{
+    Function *func = NULL;
+    int op = -1, line = 0;
+
+    if (machine.frame_count > 0)
+    {
+        CallFrame *frame = &machine.frames[machine.frame_count - 1];
+        Chunk *ch = &frame->closure->func->ch;
+        uint16_t *code = ch->op_codes.listof.Shorts, *at = machine.op_ip;
+
+        /* a frame just called has not dispatched an instruction yet */
+        if (!at || at < code || at >= code + ch->op_codes.count)
+            at = frame->ip - 1;
+
+        func = frame->closure->func;
+        if (at >= code && at < code + ch->op_codes.count)
+        {
+            op = *at;
+            line = ch->lines.listof.Ints[at - code];
+        }
+    }
+
+    size_t site = find_site(func, op, line);
+
+    sites[site].count++;
+    sites[site].bytes += block->size;
+    set_owner(block, site);
+}
+
+void profile_move(Free *from, Free *to)
+{
+    if (!owner_cap)
+        return;
+
+    Owner *o = find_owner(from);
+
+    if (o->block)
+        set_owner(to, o->site);
+}
+
+static int by_bytes(const void *a, const void *b)
+{
+    const Site *x = a, *y = b;
+    return (x->bytes < y->bytes) - (x->bytes > y->bytes);
+}
+
+void print_profile(void)
+{
+    if (!machine.profile)
+    {
+        fprintf(stderr, "-- allocation profile is off, run with --profile\n");
+        return;
+    }
+
+    for (size_t i = 0; i < site_count; i++)
+        sites[i].live = 0;
+
+    for (size_t i = 0; i < owner_cap; i++)
+        if (owners[i].block && block_page(owners[i].block))
+            sites[owners[i].site].live += owners[i].block->size;
+
+    Site *sorted = malloc(site_count * sizeof(Site) + 1);
+
+    if (!sorted)
+    {
+        perror("Failed to allocate profile report.");
+        exit(1);
+    }
+
+    memcpy(sorted, sites, site_count * sizeof(Site));
+    qsort(sorted, site_count, sizeof(Site), by_bytes);
+
+    fprintf(stderr, "-- allocation profile\n");
+    fprintf(stderr, "%10s %14s %14s  site\n", "count", "bytes", "live");
+
+    for (size_t i = 0; i < site_count && i < PROFILE_TOP; i++)
+    {
+        Site *s = &sorted[i];
+
+        if (!s->func)
+            fprintf(stderr, "%10zu %14zu %14zu  <compiler>\n", s->count, s->bytes, s->live);
+        else
+            fprintf(stderr, "%10zu %14zu %14zu  %s:%d op %d\n", s->count, s->bytes, s->live,
+                    STR(s->func->name) ? STR(s->func->name) : "<script>",
+                    s->line, s->op);
+    }
+
+    free(sorted);
+}
+
+void destroy_profile(void)
+{
+    free(sites);
+    free(site_slots);
+    free(owners);
+    sites = NULL;
+    site_slots = NULL;
+    owners = NULL;
+    site_count = site_cap = 0;
+    owner_count = owner_cap = 0;
+}
@@ -92,133 +92,116 @@ void str_cat(char *d, char *s)
         *dst++ = *src++;
 }
 
-Arena prepend_int_to_str(Arena s, Arena a)
+/* the length of a string, without a scan where the arena knows it */
+static size_t text_len(Arena *ar)
 {
-    int len = intlen(s.as.Int);
-    int ival = s.as.Int;
-    if (ival < 0)
-        ++len;
-    s = GROW_ARRAY(NULL, sizeof(char) * (len + 1 + a.as.len), ARENA_STR);
-    s.as.String = itoa(s.as.String, ival);
-    strcat(s.as.String, a.as.String);
-    ARENA_FREE(&a);
-    return s;
-}
-Arena prepend_char_to_str(Arena s, Arena a)
-{
-    char c = s.as.Char;
-    s = GROW_ARRAY(NULL, sizeof(char) * (a.as.len + 1), ARENA_STR);
-    s.as.String[0] = c;
-    strcat(s.as.String, a.as.String);
-    ARENA_FREE(&a);
-    return s;
-}
-Arena prepend_long_to_str(Arena s, Arena a)
-{
-    int len = longlen(s.as.Long);
-    long long int llint = s.as.Long;
-    if (llint < 0)
-        len++;
-    s = GROW_ARRAY(NULL, sizeof(char) * (len + 1 + a.as.len), ARENA_STR);
-    s.as.String = lltoa(s.as.String, llint);
-    strcat(s.as.String, a.as.String);
-    ARENA_FREE(&a);
-    return s;
+    return (ar->small || ar->grown) ? ar->size : strlen(STR(*ar));
 }
 
-static Arena append_int_to_str(Arena s, Arena i)
+/**
+    Builds head then tail. A result past SMALL_STR is grown: it gets
+    a block of GROW_CAPACITY its length, so a `+` in a loop appends
+    into the headroom and the string is copied only each time the
+    block doubles. Its hash is left to key_hash().
+*/
+static Arena concat(const char *head, size_t hlen, const char *tail, size_t tlen)
 {
-    int len = intlen(i.as.Int);
-    int ival = i.as.Int;
-    if (ival < 0)
-        ++len;
-    int new = len + s.as.len + 1;
+    size_t len = hlen + tlen, need = len + 1;
+
+    if (len <= SMALL_STR)
+    {
+        char str[SMALL_STR + 1];
 
-    i = GROW_ARRAY(NULL, sizeof(char) * len, ARENA_STR);
-    itoa(i.as.String, ival);
-    int tmp = s.size;
-    s = GROW_ARRAY(&s, sizeof(char) * new, ARENA_STR);
-    strcat(s.as.String + tmp, i.as.String);
-    ARENA_FREE(&i);
+        memcpy(str, head, hlen);
+        memcpy(str + hlen, tail, tlen);
+        return small_string(str, len, ARENA_STR);
+    }
 
+    Arena s = GROW_ARRAY(NULL, sizeof(char) * GROW_CAPACITY(need), ARENA_STR);
+    memcpy(s.as.String, head, hlen);
+    memcpy(s.as.String + hlen, tail, tlen);
+    s.as.String[len] = '\0';
+    s.size = len;
+    s.grown = 1;
+    s.as.hash = 0;
     return s;
 }
-static Arena append_str_to_str(Arena s, Arena str)
+
+Arena prepend_int_to_str(Arena s, Arena a)
 {
-    int new = s.as.len + str.as.len + 1;
-    s = GROW_ARRAY(&s, new * sizeof(char), ARENA_STR);
-    strcat(s.as.String, str.as.String);
-    s.as.String[new] = '\0';
-    ARENA_FREE(&str);
-    return s;
+    char buf[24];
+    itoa(buf, s.as.Int);
+    return concat(buf, strlen(buf), STR(a), text_len(&a));
 }
-static Arena append_char_to_str(Arena s, Arena c)
+Arena prepend_char_to_str(Arena s, Arena a)
 {
-
-    int size = s.as.len + 1;
-    s = GROW_ARRAY(&s, sizeof(char) * size, ARENA_STR);
-    s.as.String[s.as.len - 1] = c.as.Char;
-    s.as.String[s.as.len] = '\0';
-    return s;
+    char c = s.as.Char;
+    return concat(&c, 1, STR(a), text_len(&a));
 }
-static Arena append_long_to_str(Arena s, Arena i)
+Arena prepend_long_to_str(Arena s, Arena a)
 {
-    int len = longlen(i.as.Long);
-    long long int llint = i.as.Long;
-    int new = len + 1 + s.as.len;
-
-    if (llint < 0)
-        ++len;
-
-    i = GROW_ARRAY(NULL, sizeof(char) * (len + 1), ARENA_STR);
-    i.as.String = lltoa(i.as.String, llint);
-    s = GROW_ARRAY(&s, new * sizeof(char), ARENA_STR);
-    strcat(s.as.String, i.as.String);
-    ARENA_FREE(&i);
-    return s;
+    char buf[24];
+    lltoa(buf, s.as.Long);
+    return concat(buf, strlen(buf), STR(a), text_len(&a));
 }
-Arena append(Arena s, Arena ar)
+
+/* the text ar adds to a string, written into buf when it is a number or char */
+static const char *append_text(Arena *ar, char *buf)
 {
-    switch (ar.type)
+    switch (ar->type)
     {
     case ARENA_STR:
     case ARENA_CSTR:
-        return append_str_to_str(s, ar);
+        return STR(*ar);
     case ARENA_CHAR:
-        return append_char_to_str(s, ar);
+        buf[0] = ar->as.Char;
+        buf[1] = '\0';
+        return buf;
     case ARENA_INT:
-        return append_int_to_str(s, ar);
+        return itoa(buf, ar->as.Int);
     case ARENA_LONG:
-        return append_long_to_str(s, ar);
+        return lltoa(buf, ar->as.Long);
     default:
-        return ar;
+        return NULL;
     }
 }
 
-Arena append_to_cstr(Arena s, Arena ar)
+Arena append(Arena s, Arena ar)
 {
-    s = String(s.as.String);
-    switch (ar.type)
-    {
-    case ARENA_STR:
-    case ARENA_CSTR:
-        return append_str_to_str(s, ar);
-    case ARENA_CHAR:
-        return append_char_to_str(s, ar);
-    case ARENA_INT:
-        return append_int_to_str(s, ar);
-    case ARENA_LONG:
-        return append_long_to_str(s, ar);
-    default:
+    char buf[24];
+    const char *tail = append_text(&ar, buf);
+
+    if (!tail)
         return ar;
+
+    size_t head = text_len(&s),
+           len = (ar.type == ARENA_STR || ar.type == ARENA_CSTR)
+                     ? text_len(&ar)
+                     : strlen(tail);
+
+    /* only the string that ends at its block's terminator owns the headroom */
+    if (s.grown && !s.as.String[head] && head + len < (size_t)s.as.len)
+    {
+        memmove(s.as.String + head, tail, len + 1);
+        s.size = head + len;
+        s.as.hash = 0;
+        return s;
     }
+
+    /* a grown prefix is copied once, by concat, not spilled first */
+    return concat(s.grown ? s.as.String : STR(s), head, tail, len);
+}
+
+Arena append_to_cstr(Arena s, Arena ar)
+{
+    return append(s, ar);
 }
 
 Arena ltoa_eqcmp(long long int llint, Arena ar)
 {
     int len = longlen(llint);
     Arena a = GROW_ARRAY(NULL, sizeof(char) * len + 1, ARENA_STR);
-    Arena res = Bool(strcmp(lltoa(a.as.String, llint), ar.as.String) == 0);
+    Arena res = Bool(strcmp(lltoa(a.as.String, llint), STR(ar)) == 0);
     ARENA_FREE(&a);
     return res;
 }
@@ -226,7 +209,7 @@ Arena ltoa_neqcmp(long long int llint, Arena ar)
 {
     int len = longlen(llint);
     Arena a = GROW_ARRAY(NULL, sizeof(char) * len + 1, ARENA_STR);
-    Arena res = Bool(strcmp(lltoa(a.as.String, llint), ar.as.String) != 0);
+    Arena res = Bool(strcmp(lltoa(a.as.String, llint), STR(ar)) != 0);
     ARENA_FREE(&a);
     return res;
 }
@@ -234,7 +217,7 @@ Arena itoa_eqcmp(int ival, Arena ar)
 {
     int len = intlen(ival);
     Arena a = GROW_ARRAY(NULL, sizeof(char) * len + 1, ARENA_STR);
-    Arena res = Bool(strcmp(itoa(a.as.String, ival), ar.as.String) == 0);
+    Arena res = Bool(strcmp(itoa(a.as.String, ival), STR(ar)) == 0);
     ARENA_FREE(&a);
     return res;
 }
@@ -242,7 +225,7 @@ Arena itoa_neqcmp(int ival, Arena ar)
 {
     int len = intlen(ival);
     Arena a = GROW_ARRAY(NULL, sizeof(char) * len + 1, ARENA_STR);
-    Arena res = Bool(strcmp(itoa(a.as.String, ival), ar.as.String) != 0);
+    Arena res = Bool(strcmp(itoa(a.as.String, ival), STR(ar)) != 0);
     ARENA_FREE(&a);
     return res;
 }
@@ -253,10 +236,10 @@ Arena string_eq(Arena s, Arena c)
     switch (c.type)
     {
     case ARENA_NULL:
-        return Bool(*s.as.String == '\0');
+        return Bool(*STR(s) == '\0');
     case ARENA_CSTR:
     case ARENA_STR:
-        return Bool(strcmp(s.as.String, c.as.String) == 0);
+        return Bool(string_same(&s, &c));
     case ARENA_INT:
         return itoa_eqcmp(c.as.Int, s);
     case ARENA_LONG:
@@ -270,10 +253,10 @@ Arena string_ne(Arena s, Arena c)
     switch (c.type)
     {
     case ARENA_NULL:
-        return Bool(*s.as.String != '\0');
+        return Bool(*STR(s) != '\0');
     case ARENA_CSTR:
     case ARENA_STR:
-        return Bool(strcmp(s.as.String, c.as.String) != 0);
+        return Bool(!string_same(&s, &c));
     case ARENA_INT:
         return itoa_eqcmp(c.as.Int, s);
     case ARENA_LONG:
@@ -289,7 +272,7 @@ Arena string_gt(Arena s, Arena c)
         log_err("ERROR: string comparison type mismatch\n");
         return Bool(false);
     }
-    return Bool(strcmp(s.as.String, c.as.String) > 0);
+    return Bool(strcmp(STR(s), STR(c)) > 0);
 }
 Arena string_ge(Arena s, Arena c)
 {
@@ -298,7 +281,7 @@ Arena string_ge(Arena s, Arena c)
         log_err("ERROR: string comparison type mismatch\n");
         return Bool(false);
     }
-    return Bool(strcmp(s.as.String, c.as.String) >= 0);
+    return Bool(strcmp(STR(s), STR(c)) >= 0);
 }
 Arena string_lt(Arena s, Arena c)
 {
@@ -307,7 +290,7 @@ Arena string_lt(Arena s, Arena c)
         log_err("ERROR: string comparison type mismatch\n");
         return Bool(false);
     }
-    return Bool(strcmp(s.as.String, c.as.String) < 0);
+    return Bool(strcmp(STR(s), STR(c)) < 0);
 }
 Arena string_le(Arena s, Arena c)
 {
@@ -316,5 +299,5 @@ Arena string_le(Arena s, Arena c)
         log_err("ERROR: string comparison type mismatch\n");
         return Bool(false);
     }
-    return Bool(strcmp(s.as.String, c.as.String) <= 0);
+    return Bool(strcmp(STR(s), STR(c)) <= 0);
 }
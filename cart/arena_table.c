@@ -1,43 +1,84 @@
 #include "arena_table.h"
 #include "virtual_machine.h"
 
+static bool text_key(T type)
+{
+    switch (type)
+    {
+    case ARENA_STR:
+    case ARENA_CSTR:
+    case ARENA_VAR:
+    case ARENA_FUNC:
+    case ARENA_NATIVE:
+        return true;
+    default:
+        return false;
+    }
+}
+
+/* string keys match on their text whatever string type made them, the rest on type and value */
+static bool same_key(Arena *a, Arena *b)
+{
+    bool a_str = text_key(a->type), b_str = text_key(b->type);
+
+    if (a_str || b_str)
+        return a_str && b_str && string_same(a, b);
+    if (a->type != b->type)
+        return false;
+
+    switch (a->type)
+    {
+    case ARENA_INT:
+        return a->as.Int == b->as.Int;
+    case ARENA_DOUBLE:
+        return a->as.Double == b->as.Double;
+    case ARENA_LONG:
+        return a->as.Long == b->as.Long;
+    case ARENA_CHAR:
+        return a->as.Char == b->as.Char;
+    case ARENA_BYTE:
+        return a->as.Byte == b->as.Byte;
+    case ARENA_BOOL:
+        return a->as.Bool == b->as.Bool;
+    case ARENA_SIZE:
+        return a->as.Size == b->as.Size;
+    default:
+        return a->as.hash == b->as.hash;
+    }
+}
+
 void insert_entry(Table **t, Table entry)
 {
+    key_hash(&entry.key);
+
     Table *tmp = *t;
     size_t index = entry.key.as.hash & ((tmp - 1)->len - 1);
-    Table e = tmp[index];
-    Table *ptr = e.next;
+    Table *chain = tmp[index].next;
 
-    if (e.key.type == ARENA_NULL)
+    if (tmp[index].key.type == ARENA_NULL)
     {
         FREE_ENTRY(tmp[index].val);
         tmp[index] = entry;
         return;
     }
 
-    if (e.key.as.hash == entry.key.as.hash)
+    if (same_key(&tmp[index].key, &entry.key))
     {
-
         tmp[index] = new_entry(entry);
+        tmp[index].next = chain;
         return;
     }
 
-    Element el = find_entry(t, &entry.key);
-
-    if (el.type == NULL_OBJ)
-    {
-        ALLOC_ENTRY(&tmp[index].next, entry);
-        return;
-    }
-
-    for (; ptr; ptr = ptr->next)
-        if (ptr->key.as.hash == entry.key.as.hash)
-            goto END;
+    for (Table *ptr = chain; ptr; ptr = ptr->next)
+        if (same_key(&ptr->key, &entry.key))
+        {
+            FREE_ENTRY(ptr->val);
+            ptr->val = entry.val;
+            ptr->type = entry.type;
+            return;
+        }
 
-    return;
-END:
-    FREE_ENTRY(ptr->val);
-    ptr->val = entry.val;
+    ALLOC_ENTRY(&tmp[index].next, entry);
 }
 
 void free_entry(Element el)
@@ -76,63 +117,50 @@ void free_entry(Element el)
 
 void delete_entry(Table **t, Arena key)
 {
+    key_hash(&key);
+
     Table *a = NULL;
     a = *t;
     size_t index = key.as.hash & ((a - 1)->len - 1);
-    Table e = a[index];
+    Table *tmp = a[index].next;
 
-    if (e.key.type == ARENA_NULL || key.type == ARENA_NULL)
+    if (a[index].key.type == ARENA_NULL || key.type == ARENA_NULL)
         return;
 
-    if (e.next && (e.key.as.hash == key.as.hash))
-    {
-        Table *t = a[index].next;
-        FREE_TABLE_ENTRY(&a[index]);
-        a[index] = arena_entry(Null(), Null());
-        t->prev = NULL;
-        a[index] = new_entry(*t);
-
-        return;
-    }
-    if (!e.next && (e.key.as.hash == key.as.hash))
+    if (same_key(&a[index].key, &key))
     {
         FREE_TABLE_ENTRY(&a[index]);
         a[index] = arena_entry(Null(), Null());
-        return;
-    }
 
-    Table *tmp = e.next;
-    Table *del = NULL;
-
-    if (!tmp->next)
-    {
-        FREE_TABLE_ENTRY(tmp);
+        /* the first chained entry moves up into the slot */
+        if (tmp)
+        {
+            a[index] = new_entry(*tmp);
+            a[index].next = tmp->next;
+            if (tmp->next)
+                tmp->next->prev = NULL;
+        }
         return;
     }
 
-    for (; tmp->next; tmp = tmp->next)
-        if (tmp->key.as.hash == key.as.hash)
-            goto DEL;
-
-    if (tmp->key.as.hash == key.as.hash)
-        goto DEL_LAST;
-
-    return;
-DEL:
-    del = tmp->prev;
-    del->next = tmp->next;
-    tmp->next->prev = del;
-    FREE_TABLE_ENTRY(tmp);
-    return;
-
-DEL_LAST:
-    del = tmp->prev;
-    del->next = NULL;
-    FREE_TABLE_ENTRY(tmp);
+    for (; tmp; tmp = tmp->next)
+        if (same_key(&tmp->key, &key))
+        {
+            if (tmp->prev)
+                tmp->prev->next = tmp->next;
+            else
+                a[index].next = tmp->next;
+            if (tmp->next)
+                tmp->next->prev = tmp->prev;
+            FREE_TABLE_ENTRY(tmp);
+            return;
+        }
 }
 
 Element find_entry(Table **t, Arena *hash)
 {
+    key_hash(hash);
+
     Table *a = *t;
     size_t index = hash->as.hash & ((a - 1)->len - 1);
     Table entry = a[index];
@@ -141,7 +169,7 @@ Element find_entry(Table **t, Arena *hash)
     if (entry.key.type == ARENA_NULL)
         return null_;
 
-    if (entry.key.as.hash == hash->as.hash)
+    if (same_key(&entry.key, hash))
         switch (entry.type)
         {
         case ARENA:
@@ -167,25 +195,25 @@ Element find_entry(Table **t, Arena *hash)
     Table *tmp = entry.next;
 
     for (; tmp; tmp = tmp->next)
-        if (tmp->key.as.hash == hash->as.hash)
-            switch (entry.type)
+        if (same_key(&tmp->key, hash))
+            switch (tmp->type)
             {
             case ARENA:
-                return OBJ(entry.val.arena);
+                return OBJ(tmp->val.arena);
             case NATIVE:
-                return NATIVE(entry.val.native);
+                return NATIVE(tmp->val.native);
             case CLOSURE:
-                return CLOSURE(entry.val.closure);
+                return CLOSURE(tmp->val.closure);
             case CLASS:
-                return CLASS(entry.val.classc);
+                return CLASS(tmp->val.classc);
             case INSTANCE:
-                return INSTANCE(entry.val.instance);
+                return INSTANCE(tmp->val.instance);
             case TABLE:
-                return TABLE(entry.val.table);
+                return TABLE(tmp->val.table);
             case VECTOR:
-                return VECT(entry.val.arena_vector);
+                return VECT(tmp->val.arena_vector);
             case STACK:
-                return STK(entry.val.stack);
+                return STK(tmp->val.stack);
             default:
                 return null_;
             }
@@ -217,28 +245,11 @@ Table new_entry(Table t)
 {
     Table el;
     el.key = t.key;
-    switch (t.type)
-    {
-    case ARENA:
-        el.val.arena = t.val.arena;
-        break;
-    case NATIVE:
-        el.val.native = t.val.native;
-        break;
-    case CLOSURE:
-        el.val.closure = t.val.closure;
-        break;
-    case TABLE:
-        el.val.table = t.val.table;
-        break;
-    case VECTOR:
-        el.val.arena_vector = t.val.arena_vector;
-        break;
-    default:
-        break;
-    }
+    el.val = t.val;
+    el.val.type = t.type;
     el.next = NULL;
     el.prev = NULL;
+    el.size = t.size;
     el.type = t.type;
     return el;
 }
@@ -277,6 +288,7 @@ Table arena_entry(Arena key, Arena val)
     el.prev = NULL;
     el.size = key.size + val.size;
     el.type = ARENA;
+    el.val.type = ARENA;
     return el;
 }
 Table func_entry(Closure *clos)
@@ -288,6 +300,7 @@ Table func_entry(Closure *clos)
     el.prev = NULL;
     el.size = el.key.size;
     el.type = CLOSURE;
+    el.val.type = CLOSURE;
     return el;
 }
 Table native_entry(Native *func)
@@ -299,6 +312,7 @@ Table native_entry(Native *func)
     el.prev = NULL;
     el.size = el.key.size;
     el.type = NATIVE;
+    el.val.type = NATIVE;
     return el;
 }
 Table class_entry(Class *c)
@@ -310,6 +324,7 @@ Table class_entry(Class *c)
     el.prev = NULL;
     el.size = el.key.size;
     el.type = CLASS;
+    el.val.type = CLASS;
     return el;
 }
 Table instance_entry(Arena ar, Instance *c)
@@ -321,6 +336,7 @@ Table instance_entry(Arena ar, Instance *c)
     el.prev = NULL;
     el.size = el.key.size;
     el.type = INSTANCE;
+    el.val.type = INSTANCE;
     return el;
 }
 
@@ -333,6 +349,7 @@ Table table_entry(Arena ar, Table *t)
     el.prev = NULL;
     el.size = el.key.size;
     el.type = TABLE;
+    el.val.type = TABLE;
     return el;
 }
 Table vector_entry(Arena ar, Arena *arena_vector)
@@ -344,6 +361,7 @@ Table vector_entry(Arena ar, Arena *arena_vector)
     el.prev = NULL;
     el.size = el.key.size;
     el.type = VECTOR;
+    el.val.type = VECTOR;
     return el;
 }
 Table stack_entry(Arena ar, Stack *s)
@@ -355,6 +373,7 @@ Table stack_entry(Arena ar, Stack *s)
     el.prev = NULL;
     el.size = el.key.size;
     el.type = STACK;
+    el.val.type = STACK;
     return el;
 }
 
@@ -366,8 +385,6 @@ Table *arena_realloc_table(Table *t, size_t size)
     if (!t && size != 0)
     {
         ptr = arena_alloc_table(size);
-
-        PTR(ptr)->mark = true;
         return ptr;
     }
     if (size == 0)
@@ -380,19 +397,8 @@ Table *arena_realloc_table(Table *t, size_t size)
     size_t new_size = 0;
     ptr = arena_alloc_table(size);
 
-    PTR(ptr)->mark = true;
-
     if (size > (t - 1)->size)
-    {
         new_size = (t - 1)->size;
-
-#ifdef DEBUG_STRESS_GC
-        collect_garbage();
-#else
-        if (machine.bytes_allocated > machine.next_gc)
-            collect_garbage();
-#endif
-    }
     else
         new_size = size;
 
@@ -403,6 +409,7 @@ Table *arena_realloc_table(Table *t, size_t size)
         for (Table *tab = t[i].next; tab; tab = tab->next)
             insert_entry(&ptr, new_entry(*tab));
     }
+    WRITE_BARRIER(TABLE(ptr));
 
     FREE(PTR((t - 1)));
     --t;
@@ -438,16 +445,15 @@ void write_table(Table *t, Arena a, Element b)
 
     if (load_capacity < (t - 1)->count + 1)
     {
-        int tmp = (t - 1)->len;
         (t - 1)->len *= INC;
         t = GROW_TABLE(t, t->len);
-        machine.bytes_allocated -= tmp;
     }
 
     (t - 1)->count++;
 
 OVERWRITE:
     insert_entry(&t, Entry(a, b));
+    WRITE_BARRIER(TABLE(t));
 }
 
 Table *arena_alloc_table(size_t size)
@@ -0,0 +1,111 @@
+#include "arena_memory.h"
+#include "virtual_machine.h"
+#include <fcntl.h>
+#include <signal.h>
+#include <unistd.h>
+
+/**
+    The last TRACE_EVENTS events, dumped oldest first as
+        "YKTR", u32 version, u32 event size, u64 count, events
+    and read back by tools/ykes_trace.c.
+*/
+static TraceEvent trace_ring[TRACE_EVENTS];
+static uint64_t trace_seq;
+
+void trace_event(TraceKind kind, uint64_t a, uint64_t b)
+{
+    TraceEvent *e = &trace_ring[trace_seq & (TRACE_EVENTS - 1)];
+
+    e->a = a;
+    e->b = b;
+    e->seq = trace_seq++;
+    e->kind = kind;
+}
+
+/* only write(2), so a crash handler may call it */
+static bool trace_write(int fd)
+{
+    uint64_t count = trace_seq < TRACE_EVENTS ? trace_seq : TRACE_EVENTS;
+    uint64_t first = trace_seq - count;
+    uint32_t head[] = {TRACE_VERSION, sizeof(TraceEvent)};
+    bool ok = true;
+
+    ok = write(fd, "YKTR", 4) == 4 && ok;
+    ok = write(fd, head, sizeof(head)) == sizeof(head) && ok;
+    ok = write(fd, &count, sizeof(count)) == sizeof(count) && ok;
+
+    for (uint64_t i = first; i < trace_seq; i++)
+        ok = write(fd, &trace_ring[i & (TRACE_EVENTS - 1)], sizeof(TraceEvent)) == sizeof(TraceEvent) && ok;
+    return ok;
+}
+
+bool trace_dump(const char *path)
+{
+    int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+
+    if (fd < 0)
+        return false;
+
+    bool ok = trace_write(fd);
+    return (close(fd) == 0) && ok;
+}
+
+static void on_trace_signal(int sig)
+{
+    (void)sig;
+    machine.trace = !machine.trace;
+}
+
+/* ykes-<pid>.trace without stdio, the heap may be what broke */
+static void on_crash(int sig, siginfo_t *info, void *ctx)
+{
+    static const char overflow[] = "ERROR: Stack overflow.\n";
+    char path[32] = "ykes-";
+
+    (void)ctx;
+    if ((sig == SIGSEGV || sig == SIGBUS) && in_stack_guard(info->si_addr))
+        (void)!write(STDERR_FILENO, overflow, sizeof(overflow) - 1);
+
+    char digits[16];
+    size_t len = strlen(path), n = 0;
+
+    for (long pid = (long)getpid(); pid > 0 || n == 0; pid /= 10)
+        digits[n++] = (char)('0' + pid % 10);
+    while (n > 0)
+        path[len++] = digits[--n];
+    memcpy(path + len, ".trace", sizeof(".trace"));
+
+    if (trace_seq > 0)
+    {
+        int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+
+        if (fd >= 0)
+        {
+            trace_write(fd);
+            close(fd);
+        }
+    }
+
+    raise(sig);
+}
+
+/* only a run started with --trace takes over SIGUSR2 and the fatal signals */
+void initialize_tracer(void)
+{
+    if (!machine.trace)
+        return;
+
+    struct sigaction act;
+    memset(&act, 0, sizeof(act));
+    act.sa_handler = on_trace_signal;
+    act.sa_flags = SA_RESTART;
+    sigemptyset(&act.sa_mask);
+    sigaction(SIGUSR2, &act, NULL);
+
+    int crashes[] = {SIGSEGV, SIGBUS, SIGILL, SIGFPE, SIGABRT};
+
+    act.sa_sigaction = on_crash;
+    act.sa_flags = SA_RESETHAND | SA_SIGINFO;
+    for (size_t i = 0; i < sizeof(crashes) / sizeof(crashes[0]); i++)
+        sigaction(crashes[i], &act, NULL);
+}
@@ -108,7 +108,10 @@ static char *read_file(const char *path)
     rewind(file);
 
     char *buffer = NULL;
+
+    region_enter();
     buffer = ALLOC(fileSize + 1);
+    region_leave();
 
     if (!buffer)
     {
@@ -151,7 +154,10 @@ static char *get_name(char *path)
         ;
 
     char *file = NULL;
+
+    region_enter();
     file = ALLOC((count + 1) * sizeof(char));
+    region_leave();
 
     strcpy(file, tmp);
 
@@ -197,7 +203,9 @@ static void include_dir(Compiler *c, Arena inc)
             error("Double include.", &c->parser);
             exit(1);
         }
+        region_enter();
         write_table(c->base->lookup.include, e, OBJ(e));
+        region_leave();
 
         char *file = read_file(f_path);
 
@@ -266,7 +274,9 @@ static void include_file(Compiler *c)
         exit(1);
     }
 
+    region_enter();
     write_table(c->base->lookup.include, inc, OBJ(inc));
+    region_leave();
 
     consume(TOKEN_CH_SEMI, "Expect `;` at end of include statement.", &c->parser);
     remaining = (char *)c->parser.cur.start;
@@ -323,9 +333,11 @@ static void class_declaration(Compiler *c)
     classc->closures = GROW_TABLE(NULL, STACK_SIZE);
 
     ClassCompiler *class = NULL;
-    class = ALLOC(sizeof(ClassCompiler));
 
+    region_enter();
+    class = ALLOC(sizeof(ClassCompiler));
     write_table(c->base->lookup.class, classc->name, OBJ(Int(c->base->count.class)));
+    region_leave();
     c->base->stack.instance[c->base->count.class ++] = classc;
     class->instance_name = ar;
 
@@ -438,7 +450,9 @@ static void func_declaration(Compiler *c)
     consume(TOKEN_ID, "Expect function name.", &c->parser);
     Arena ar = parse_func_id(c);
 
+    region_enter();
     write_table(c->base->lookup.call, ar, OBJ(Int(c->base->count.call++)));
+    region_leave();
     func_body(c, CLOSURE, ar);
 }
 
@@ -670,7 +684,7 @@ static void while_statement(Compiler *c)
     consume(TOKEN_CH_LPAREN, "Expect `(` after 'while'.", &c->parser);
     expression(c);
     if (c->count.scope_depth > 0)
-        emit_bytes(c, OP_POPN, add_constant(&c->func->ch, OBJ(Int(2))));
+        emit_byte(c, OP_POP);
     c->flags &= _FLAG_FIRST_EXPR_RST;
     consume(TOKEN_CH_RPAREN, "Expect `)` after 'while' condition.", &c->parser);
 
@@ -732,9 +746,13 @@ static void each_statement(Compiler *c)
     consume(TOKEN_CH_RPAREN, "Expect `)` following an each expression.", &c->parser);
 
     statement(c);
+    if (c->count.scope_depth > 0)
+        emit_bytes(c, OP_POPN, add_constant(&c->func->ch, OBJ(Int(2))));
     emit_loop(c, start);
 
     patch_jump(c, exit);
+    if (c->count.scope_depth > 0)
+        emit_byte(c, OP_POP);
 }
 
 static void consume_if(Compiler *c)
@@ -1008,8 +1026,12 @@ static void end_scope(Compiler *c)
 {
 
     c->count.scope_depth--;
-    if (c->count.local > 0 && (c->stack.local[c->count.local - 1].depth > c->count.scope_depth))
-        emit_bytes(c, OP_POPN, add_constant(&c->func->ch, OBJ(Int(c->count.local - 1))));
+
+    int n = 0;
+    while (n < c->count.local && c->stack.local[c->count.local - 1 - n].depth > c->count.scope_depth)
+        n++;
+    if (n > 0)
+        emit_bytes(c, OP_POPN, add_constant(&c->func->ch, OBJ(Int(n))));
 
     while (c->count.local > 0 && (c->stack.local[c->count.local - 1].depth > c->count.scope_depth))
     {
@@ -1469,6 +1491,7 @@ static void array_alloc(Compiler *c)
     {
         int arg = add_constant(&c->func->ch, OBJ(GROW_ARRAY(NULL, atoi(c->parser.pre.start), ARENA_INTS)));
         emit_bytes(c, OP_MOV_CNT_R1, arg);
+        emit_byte(c, OP_CPY_R1);
         if (c->count.scope_depth > 0 || (CALL_PARAM(c->flags)))
             emit_byte(c, OP_STR_R1);
     }
@@ -1612,7 +1635,9 @@ static Arena get_id(Compiler *c)
 
     uint8_t get, set;
 
+    region_enter();
     Arena args = GROW_ARRAY(NULL, 3 * sizeof(int), ARENA_INTS);
+    region_leave();
     int arg = resolve_local(c, &ar);
 
     if (arg != -1)
@@ -1979,6 +2004,7 @@ static void int_array(Compiler *c)
 
     int arg = add_constant(&c->func->ch, el);
     emit_bytes(c, OP_MOV_CNT_R1, arg);
+    emit_byte(c, OP_CPY_R1);
     if (c->count.scope_depth > 0)
         emit_byte(c, OP_STR_R1);
 }
@@ -1999,6 +2025,7 @@ static void double_array(Compiler *c)
 
     int arg = add_constant(&c->func->ch, el);
     emit_bytes(c, OP_MOV_CNT_R1, arg);
+    emit_byte(c, OP_CPY_R1);
     if (c->count.scope_depth > 0)
         emit_byte(c, OP_STR_R1);
 }
@@ -2019,6 +2046,7 @@ static void string_array(Compiler *c)
 
     int arg = add_constant(&c->func->ch, el);
     emit_bytes(c, OP_MOV_CNT_R1, arg);
+    emit_byte(c, OP_CPY_R1);
     if (c->count.scope_depth > 0)
         emit_byte(c, OP_STR_R1);
 }
@@ -2038,6 +2066,7 @@ static void long_array(Compiler *c)
 
     int arg = add_constant(&c->func->ch, el);
     emit_bytes(c, OP_MOV_CNT_R1, arg);
+    emit_byte(c, OP_CPY_R1);
     if (c->count.scope_depth > 0)
         emit_byte(c, OP_STR_R1);
 }
@@ -2341,10 +2370,10 @@ static int parse_var(Compiler *c, Arena ar)
 
 static bool idcmp(Arena a, Arena b)
 {
-    if (a.as.len != b.as.len)
+    if (STR_LEN(a) != STR_LEN(b))
         return false;
 
-    return a.as.hash == b.as.hash;
+    return string_same(&a, &b);
 }
 
 static int resolve_local(Compiler *c, Arena *name)
@@ -2441,7 +2470,7 @@ static Function *end_compile(Compiler *a)
     if (!a->parser.err)
         disassemble_chunk(
             &a->func->ch,
-            a->func->name.as.String);
+            STR(a->func->name));
 #endif
     if (a->enclosing)
     {
@@ -2450,6 +2479,8 @@ static Function *end_compile(Compiler *a)
         a = a->enclosing;
         a->parser = tmp;
     }
+    else
+        region_free();
 
     return f;
 }
@@ -2480,18 +2511,14 @@ Function *compile(const char *src)
     c.base->meta.cwd = NULL;
     c.base->meta.current_file = NULL;
 
+    /* the lookups live in the region and die with it at end_compile */
+    region_enter();
+
     c.base->lookup.call = GROW_TABLE(NULL, TABLE_SIZE);
     c.base->lookup.class = GROW_TABLE(NULL, TABLE_SIZE);
     c.base->lookup.include = GROW_TABLE(NULL, TABLE_SIZE);
     c.base->lookup.native = GROW_TABLE(NULL, TABLE_SIZE);
 
-    // mark_obj(c.base->func)
-
-    mark_obj(TABLE(c.base->lookup.call));
-    mark_obj(TABLE(c.base->lookup.class));
-    mark_obj(TABLE(c.base->lookup.include));
-    mark_obj(TABLE(c.base->lookup.native));
-
     c.base->hash.len = CString("len");
     c.base->hash.init = String("init");
     c.base->hash.push = CString("push");
@@ -2507,8 +2534,15 @@ Function *compile(const char *src)
     write_table(c.base->lookup.native, CString("prime"), OBJ(Int(c.base->count.native++)));
     write_table(c.base->lookup.native, CString("file"), OBJ(Int(c.base->count.native++)));
     write_table(c.base->lookup.native, CString("strstr"), OBJ(Int(c.base->count.native++)));
+    write_table(c.base->lookup.native, CString("gc_trim"), OBJ(Int(c.base->count.native++)));
+    write_table(c.base->lookup.native, CString("gc_stats"), OBJ(Int(c.base->count.native++)));
+    write_table(c.base->lookup.native, CString("gc_profile"), OBJ(Int(c.base->count.native++)));
+    write_table(c.base->lookup.native, CString("heap_dump"), OBJ(Int(c.base->count.native++)));
+    write_table(c.base->lookup.native, CString("trace_dump"), OBJ(Int(c.base->count.native++)));
     // write_table(c.base->lookup.native, CString("reverse"), OBJ(Int(c.base->count.native++)));
 
+    region_leave();
+
     advance_compiler(&c.parser);
 
     while (!match(TOKEN_EOF, &c.parser))
@@ -2517,12 +2551,6 @@ Function *compile(const char *src)
 
     Function *f = end_compile(&c);
 
-    FREE(PTR((c.base->lookup.call - 1)));
-    FREE(PTR((c.base->lookup.native - 1)));
-    FREE(PTR((c.base->lookup.class - 1)));
-    FREE(PTR((c.base->lookup.include - 1)));
-    FREE(PTR((c.base->hash.init.as.String)));
-
     return c.parser.err ? NULL : f;
 }
 Function *compile_path(const char *src, const char *path, const char *name)
@@ -2537,6 +2565,8 @@ Function *compile_path(const char *src, const char *path, const char *name)
     c.base->meta.cwd = path;
     c.base->meta.current_file = name;
 
+    region_enter();
+
     c.base->lookup.call = GROW_TABLE(NULL, TABLE_SIZE);
     c.base->lookup.class = GROW_TABLE(NULL, TABLE_SIZE);
     c.base->lookup.include = GROW_TABLE(NULL, TABLE_SIZE);
@@ -2555,16 +2585,18 @@ Function *compile_path(const char *src, const char *path, const char *name)
     c.parser.err = false;
     c.parser.current_file = name;
 
-    mark_obj(TABLE(c.base->lookup.call));
-    mark_obj(TABLE(c.base->lookup.class));
-    mark_obj(TABLE(c.base->lookup.include));
-    mark_obj(TABLE(c.base->lookup.native));
-
     write_table(c.base->lookup.native, CString("clock"), OBJ(Int(c.base->count.native++)));
     write_table(c.base->lookup.native, CString("square"), OBJ(Int(c.base->count.native++)));
     write_table(c.base->lookup.native, CString("prime"), OBJ(Int(c.base->count.native++)));
     write_table(c.base->lookup.native, CString("file"), OBJ(Int(c.base->count.native++)));
     write_table(c.base->lookup.native, CString("strstr"), OBJ(Int(c.base->count.native++)));
+    write_table(c.base->lookup.native, CString("gc_trim"), OBJ(Int(c.base->count.native++)));
+    write_table(c.base->lookup.native, CString("gc_stats"), OBJ(Int(c.base->count.native++)));
+    write_table(c.base->lookup.native, CString("gc_profile"), OBJ(Int(c.base->count.native++)));
+    write_table(c.base->lookup.native, CString("heap_dump"), OBJ(Int(c.base->count.native++)));
+    write_table(c.base->lookup.native, CString("trace_dump"), OBJ(Int(c.base->count.native++)));
+
+    region_leave();
 
     advance_compiler(&c.parser);
 
@@ -2574,12 +2606,7 @@ Function *compile_path(const char *src, const char *path, const char *name)
 
     Function *f = end_compile(&c);
 
-    FREE(PTR(c.parser.current_file));
-    FREE(PTR((c.base->lookup.call - 1)));
-    FREE(PTR((c.base->lookup.native - 1)));
-    FREE(PTR((c.base->lookup.class - 1)));
-    FREE(PTR((c.base->lookup.include - 1)));
-    FREE(PTR((c.base->hash.init.as.String)));
+    FREE(PTR(name));
 
     return c.parser.err ? NULL : f;
 }
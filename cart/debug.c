@@ -290,6 +290,8 @@ int disassemble_instruction(Chunk *c, int offset)
     case OP_MOV_R3:
         return byte_instruction("OP_MOV_R3", c, offset);
 
+    case OP_CPY_R1:
+        return simple_instruction("OP_CPY_R1", offset);
     case OP_STR_R1:
         return simple_instruction("OP_STR_R1", offset);
     case OP_STR_R2:
@@ -3,6 +3,8 @@
 #include <stdlib.h>
 #include <stdbool.h>
 
+#define SMALL_STR 15
+
 typedef enum
 {
 
@@ -71,6 +73,7 @@ typedef enum
     OP_PREPEND_ARRAY_VAL,
 
     OP_CPY_ARRAY,
+    OP_CPY_R1,
     OP_POP,
     OP_POPN,
     OP_PUSH,
@@ -299,7 +302,7 @@ typedef struct Class Class;
 typedef struct BoundClosure BoundClosure;
 typedef struct Instance Instance;
 typedef struct Table Table;
-typedef Element (*NativeFn)(int argc, Stack *argv);
+typedef Element (*NativeFn)(int argc, Element *argv);
 
 union Vector
 {
@@ -327,6 +330,7 @@ struct Value
             char *String;
         };
 
+        char Small[SMALL_STR + 1];
         size_t Size;
         uint8_t Byte;
         int Int;
@@ -338,10 +342,28 @@ struct Value
     };
 };
 
+/**
+    A string of SMALL_STR bytes or fewer is kept in as.Small, over
+    len, count and the pointer, with `small` set; its hash stays
+    where it is and its length is `size`. Such a string owns no
+    block, so read it through STR() and STR_LEN().
+
+    A longer string built by `+` is `grown`: its block has headroom,
+    as.len counts the block and `size` the string. Only the string
+    whose end is the block's terminator appends into the headroom, so
+    several strings may share one block as successive prefixes of it;
+    STR() copies a prefix out before it is read.
+
+    String() keeps one block per text and marks the Arena `interned`,
+    so two interned strings are the same text only if they share it.
+*/
 struct Arena
 {
     size_t size;
     T type;
+    bool small;
+    bool grown;
+    bool interned;
 
     union
     {
@@ -433,8 +455,8 @@ struct Upval
     int len;
     int count;
     size_t size;
-    Stack *index;
-    Stack closed;
+    Element *index;
+    Element closed;
     Upval *next;
 };
 
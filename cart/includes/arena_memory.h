@@ -7,19 +7,58 @@
 
 #define LOAD_FACTOR 0.75
 #define FRAMES_MAX 500
+#define FRAMES_RESERVE (sizeof(CallFrame) << 20)
+#define STACK_RESERVE (1ULL << 32)
+#define GUARD PAGE
 #define CAPACITY 64
 #define INC 2
 #define PAGE 16384
 #define PAGE_COUNT 16
 #define INIT_GLOBAL \
     (PAGE * PAGE_COUNT)
+#define HEAP_RESERVE (1ULL << 36)
+#define HEAP_GROWTH 8
+#define HEAP_TRIM_HIGH 4
+#define HEAP_TRIM_LOW 2
+#define HUGE_PAGE (1ULL << 21)
+#define HUGE_ALIGN(addr) \
+    (((addr) + (HUGE_PAGE - 1)) & ~(HUGE_PAGE - 1))
 #define STACK_SIZE 64
 #define MIN_SIZE 8
 #define NATIVE_STACK_SIZE 32
 #define TABLE_SIZE 128
 #define MACHINE_STACK 256
+#define FRAME_SLOTS 1024
 #define IP_SIZE 100
 #define MEM_OFFSET 1
+#define ALIGNMENT 16
+#define SMALL_MAX 512
+#define SMALL_SHIFT 9
+#define SMALL_BINS (SMALL_MAX / ALIGNMENT)
+#define BIN_COUNT 64
+#define NURSERY_SIZE INIT_GLOBAL
+#define NURSERY_MAX SMALL_MAX
+#define SLAB_SIZE PAGE
+#define LARGE_MIN (PAGE * 8)
+#define LARGE_PAGE 0xff
+#define OS_PAGE 4096
+#define SLAB_YOUNG_MAX 4096
+#define REGION_CHUNK (PAGE * 4)
+#define GC_PAUSE_US 500
+#define GC_HEAP_INIT (900 * 900)
+#define GC_MIN_INTERVAL INIT_GLOBAL
+#define GC_SLICE_CHECK 32
+#define GC_MAX_THREADS 16
+#define GC_PAR_MIN 64
+#define GC_STEAL_MAX 256
+#define GC_COMPACT_MIN INIT_GLOBAL
+#define GC_COMPACT_FRAG 0.5
+#define GC_COMPACT_SPARSE 4
+#define GC_LIMIT_NEAR 0.9
+#define PROFILE_TOP 40
+#define HEAP_DUMP_VERSION 1
+#define TRACE_EVENTS 4096
+#define TRACE_VERSION 1
 #define ALLOC(size) \
     alloc_ptr(size + OFFSET)
 
@@ -66,6 +105,10 @@
 
 #define OBJ(o) \
     Obj(o)
+#define STR(ar) \
+    arena_str(&(ar))
+#define STR_LEN(ar) \
+    ((ar).small || (ar).grown ? (int)(ar).size : (ar).as.len)
 #define VECT(o) \
     vector(o)
 #define FUNC(ar) \
@@ -92,30 +135,129 @@
 #define FREE_INSTANCE(c) \
     free_instance(c)
 
+#define WRITE_BARRIER(obj) \
+    write_barrier(obj)
+
+#define TRACE(kind, a, b)                                               \
+    do                                                                  \
+    {                                                                   \
+        if (machine.trace)                                              \
+            trace_event(kind, (uint64_t)(uintptr_t)(a), (uint64_t)(b)); \
+    } while (0)
+
 typedef union Free Free;
 typedef struct CallFrame CallFrame;
 typedef struct vm vm;
 typedef long long int Align;
 
+typedef enum
+{
+    GC_NONE,
+    GC_MINOR,
+    GC_MAJOR
+} Collection;
+
+typedef enum
+{
+    TRACE_ALLOC,
+    TRACE_FREE,
+    TRACE_GC_BEGIN,
+    TRACE_GC_END,
+    TRACE_CALL,
+    TRACE_NATIVE,
+    TRACE_RETURN
+} TraceKind;
+
+/* a is the pointer or pass, b the size, live bytes or frame depth */
+typedef struct
+{
+    uint64_t a;
+    uint64_t b;
+    uint32_t seq;
+    uint32_t kind;
+} TraceEvent;
+
+typedef struct
+{
+    size_t minors;
+    size_t majors;
+    size_t pauses;
+    double last_pause;
+    double max_pause;
+    double total_pause;
+    size_t last_marked;
+    size_t marked;
+    size_t freed;
+    size_t compactions;
+    size_t moved;
+    size_t heap_size;
+    size_t heap_limit;
+    size_t bytes_allocated;
+    size_t next_gc;
+    double survival;
+    size_t free_bytes;
+    size_t free_blocks;
+    size_t largest_free;
+    double fragmentation;
+} GcStats;
+
 union Free
 {
 
     struct
     {
-        bool mark;
+        bool free : 1;
+        bool prev_free : 1;
+        bool young : 1;
+        bool perm : 1;
+        bool remembered : 1;
+        bool moved : 1;
+        unsigned char slab;
         size_t size;
-        Free *next;
     };
     Align align;
 };
 
-static Free *mem;
-
 #define PTR(ptr) \
     (((Free *)ptr) - 1)
 
 #define OFFSET sizeof(Free)
 
+/* a free block links through its first payload words; a moved one keeps its forward there */
+#define FREE_NEXT(block) \
+    (((Free **)((block) + 1))[0])
+#define FREE_PREV(block) \
+    (((Free **)((block) + 1))[1])
+
+#define ALIGN(size) \
+    (((size) + (ALIGNMENT - 1)) & ~((size_t)ALIGNMENT - 1))
+#define MIN_BLOCK \
+    ALIGN(OFFSET + 2 * sizeof(Free *) + sizeof(size_t))
+#define PAGE_HEADER \
+    ALIGN(OFFSET)
+#define PAGE_FENCE \
+    ALIGN(OFFSET)
+#define PAGE_WORDS(size) \
+    (((size) / ALIGNMENT + 63) / 64)
+#define PAGE_META(size) \
+    ALIGN(3 * PAGE_WORDS(size) * sizeof(uint64_t))
+#define LARGE_META \
+    ALIGN(3 * sizeof(uint64_t))
+#define LARGE_REGION(size) \
+    (((size) + PAGE_HEADER + LARGE_META + PAGE_FENCE + OS_PAGE - 1) & ~((size_t)OS_PAGE - 1))
+
+/**
+    Boundary tags: every block starts with its Free header, and a
+    free block also repeats its size in the last word (the footer).
+    `prev_free` on a header says the footer just before it is valid.
+*/
+#define FOOTER(block) \
+    (*(size_t *)((char *)(block) + (block)->size - sizeof(size_t)))
+#define NEXT_BLOCK(block) \
+    ((Free *)((char *)(block) + (block)->size))
+#define PREV_BLOCK(block) \
+    ((Free *)((char *)(block) - *((size_t *)(block)-1)))
+
 void initialize_global_memory(void);
 void destroy_global_memory(void);
 
@@ -131,12 +273,33 @@ void mark_table(Table **t);
 bool is_obj(Element el);
 bool _null(Element el);
 void collect_garbage(void);
+void gc_trim(void);
+bool heap_exhausted(void);
+GcStats gc_stats(void);
+void print_gc_stats(void);
+void print_profile(void);
+void profile_alloc(Free *block);
+void profile_move(Free *from, Free *to);
+void destroy_profile(void);
+bool heap_dump(const char *path);
+void initialize_heap_dump(void);
+void trace_event(TraceKind kind, uint64_t a, uint64_t b);
+bool trace_dump(const char *path);
+void initialize_tracer(void);
 void free_garbage(void);
+void write_barrier(Element obj);
 
 void sweep(void);
 
 void *alloc_ptr(size_t size);
 void free_ptr(Free *new);
+Free *block_page(Free *block);
+Free *obj_block(Element el);
+size_t hash_ptr(uintptr_t key);
+
+void region_enter(void);
+void region_leave(void);
+void region_free(void);
 
 Arena arena_init(void *data, size_t size, T type);
 Arena arena_alloc(size_t size, T type);
@@ -171,6 +334,44 @@ Arena Long(long long int llint);
 Arena Double(double dval);
 Arena String(const char *str);
 Arena CString(const char *str);
+Arena small_string(const char *str, size_t size, T type);
+Arena spill_string(Arena ar);
+
+/* a grown prefix that runs on into the string appended after it */
+#define STALE_PREFIX(ar) \
+    ((ar).type == ARENA_STR && (ar).grown && (ar).as.String[(ar).size])
+
+static inline char *arena_str(Arena *ar)
+{
+    if (ar->small)
+        return ar->as.Small;
+    if (STALE_PREFIX(*ar))
+        *ar = spill_string(*ar);
+    return ar->as.String;
+}
+
+/* a string's bytes and length where they lie, without spilling a stale prefix */
+static inline const char *str_bytes(Arena *ar, size_t *len)
+{
+    if (ar->small || ar->grown)
+    {
+        *len = ar->size;
+        return ar->small ? ar->as.Small : ar->as.String;
+    }
+
+    *len = ar->as.String ? strlen(ar->as.String) : 0;
+    return ar->as.String ? ar->as.String : "";
+}
+
+/* spills a stale prefix where it is stored, so later reads copy nothing */
+static inline bool flatten_str(Element *el)
+{
+    if (el->type != ARENA || !STALE_PREFIX(el->arena))
+        return false;
+
+    el->arena = spill_string(el->arena);
+    return true;
+}
 Arena Bool(bool boolean);
 Arena Size(size_t Size);
 Arena Null(void);
@@ -206,7 +407,7 @@ void free_function(Function *func);
 Closure *new_closure(Function *func);
 void free_closure(Closure **closure);
 
-Upval *upval(Stack *index);
+Upval *upval(Element *index);
 void free_upval(Upval *up);
 
 Native *native(NativeFn native, Arena ar);
@@ -216,6 +417,34 @@ void print(Element ar);
 void print_line(Element ar);
 
 long long int hash(Arena key);
+
+/* a string built or written at run time is hashed when a table first keys on it */
+static inline void key_hash(Arena *key)
+{
+    if ((key->type == ARENA_STR || key->type == ARENA_CSTR) && !key->as.hash)
+        key->as.hash = hash(*key);
+}
+
+/**
+    Strings sharing a block and length match without a read. Two
+    interned strings in different blocks cannot match, and differing
+    hashes rule a match out too; a hash of 0 is one not taken yet.
+    Anything else is compared in place, so nothing is spilled.
+*/
+static inline bool string_same(Arena *a, Arena *b)
+{
+    size_t alen = 0, blen = 0;
+
+    if (!a->small && !b->small && a->as.String == b->as.String && a->size == b->size)
+        return true;
+    if (a->interned && b->interned)
+        return false;
+    if (a->as.hash && b->as.hash && a->as.hash != b->as.hash)
+        return false;
+
+    const char *as = str_bytes(a, &alen), *bs = str_bytes(b, &blen);
+    return alen == blen && memcmp(as, bs, alen) == 0;
+}
 void alloc_entry(Table **e, Table el);
 
 void arena_free_table(Table *t);
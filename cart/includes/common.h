@@ -9,6 +9,5 @@
 // #define DEBUG_PRINT_CODE
 
 // #define DEBUG_STRESS_GC
-#define DEBUG_LOG_GC
 
 #endif
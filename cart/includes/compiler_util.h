@@ -359,6 +359,11 @@ static PRule rules[] = {
     [TOKEN_SQRT] = {parse_native_var_arg, NULL, PREC_CALL},
     [TOKEN_PRIME] = {parse_native_var_arg, NULL, PREC_CALL},
     [TOKEN_FILE] = {parse_native_var_arg, NULL, PREC_CALL},
+    [TOKEN_GC_TRIM] = {parse_native_var_arg, NULL, PREC_CALL},
+    [TOKEN_GC_STATS] = {parse_native_var_arg, NULL, PREC_CALL},
+    [TOKEN_GC_PROFILE] = {parse_native_var_arg, NULL, PREC_CALL},
+    [TOKEN_HEAP_DUMP] = {parse_native_var_arg, NULL, PREC_CALL},
+    [TOKEN_TRACE_DUMP] = {parse_native_var_arg, NULL, PREC_CALL},
     // [TOKEN_REVERSE] = {parse_native_var_arg, NULL, PREC_CALL},
 
     [TOKEN_PRINT] = {NULL, NULL, PREC_NONE},
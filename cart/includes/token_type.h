@@ -109,6 +109,11 @@ enum
     TOKEN_SQRT,
     TOKEN_FILE,
     TOKEN_PRIME,
+    TOKEN_GC_TRIM,
+    TOKEN_GC_STATS,
+    TOKEN_GC_PROFILE,
+    TOKEN_HEAP_DUMP,
+    TOKEN_TRACE_DUMP,
     TOKEN_BREAK,
     TOKEN_DEFAULT,
     TOKEN_ELIF,
@@ -4,6 +4,7 @@
 #include "debug.h"
 #include "arena_table.h"
 #include <limits.h>
+#include <signal.h>
 
 #define _FLAG_INSTANCE_CALL_SET 0x01 /* 0001 */
 #define _FLAG_INSTANCE_CALL_RST 0x0E /* 1110 */
@@ -24,7 +25,7 @@ struct CallFrame
     Closure *closure;
     uint16_t *ip;
     uint16_t *ip_start;
-    Stack *slots;
+    Element *slots;
 };
 
 struct vm
@@ -51,16 +52,23 @@ struct vm
         r4,
         r5; /* Everything else */
 
-    CallFrame frames[FRAMES_MAX];
-    Stack *stack;
+    int frame_cap; /* frames committed so far */
+    CallFrame *frames;
+    Element *stack; /* values only, with one spare slot below */
+    Element *stack_top;
+    Element *stack_end;
 
     // Stack *reg_stack;
     Stack *gray_stack;
-
-    Free *gc_work_list;
-    Free *gc_work_list_head;
+    Stack *remembered;
 
     bool collect;
+    bool stats;
+    bool profile;
+    bool trace;
+    uint16_t *op_ip; /* the instruction being run, kept while profiling */
+    Collection gc_request;
+    volatile sig_atomic_t dump_request; /* SIGUSR1, served at the next safepoint */
     Stack *call_stack;
     Stack *class_stack;
     Stack *native_calls;
@@ -73,6 +81,7 @@ vm machine;
 
 void initVM(void);
 void freeVM(void);
+bool in_stack_guard(void *ptr);
 
 Interpretation run(void);
 Interpretation interpret(const char *source);
@@ -3,11 +3,16 @@
 #include "arena_math.h"
 
 static Element find(Table *t, Arena tmp);
-static void close_upvalues(Stack *local);
+static void close_upvalues(Element *local);
 static void define_native(Arena ar, NativeFn native);
-static inline Element clock_native(int argc, Stack *argv);
-static inline Element file_native(int argc, Stack *argv);
-static inline Element square_native(int argc, Stack *argv);
-static inline Element prime_native(int argc, Stack *argv);
-static inline Element strstr_native(int argc, Stack *argv);
+static inline Element clock_native(int argc, Element *argv);
+static inline Element file_native(int argc, Element *argv);
+static inline Element square_native(int argc, Element *argv);
+static inline Element prime_native(int argc, Element *argv);
+static inline Element strstr_native(int argc, Element *argv);
+static inline Element gc_trim_native(int argc, Element *argv);
+static inline Element gc_stats_native(int argc, Element *argv);
+static inline Element gc_profile_native(int argc, Element *argv);
+static inline Element heap_dump_native(int argc, Element *argv);
+static inline Element trace_dump_native(int argc, Element *argv);
 #endif
@@ -5,27 +5,62 @@
 #include <sys/stat.h>
 #include <pwd.h>
 #include <unistd.h>
+#include <ctype.h>
 
 static void repl(void);
 static void run_file(const char *path);
 static char *read_file(const char *path);
+static bool gc_option(const char *arg);
+static void usage(void);
 
 int main(int argc, char **argv)
 {
 
+    for (; argc > 1 && strncmp(argv[1], "--", 2) == 0; argc--, argv++)
+    {
+        if (strcmp(argv[1], "--stats") == 0)
+            machine.stats = true;
+        else if (strcmp(argv[1], "--profile") == 0)
+            machine.profile = true;
+        else if (strcmp(argv[1], "--trace") == 0)
+            machine.trace = true;
+        else if (!gc_option(argv[1]))
+            usage();
+    }
+
     if (argc == 1)
         repl();
     else if (argc == 2)
         run_file(argv[1]);
     else
-    {
-        fprintf(stderr, "USAGE: ykes [path]\n");
-        exit(69);
-    }
+        usage();
 
     return EXIT_SUCCESS;
 }
 
+static void usage(void)
+{
+    fprintf(stderr, "USAGE: ykes [--stats] [--profile] [--trace] [--gc-NAME=VALUE ...] [path]\n");
+    exit(69);
+}
+
+/* --gc-min-interval=1M becomes YKES_GC_MIN_INTERVAL=1M */
+static bool gc_option(const char *arg)
+{
+    char name[64] = "YKES_GC_";
+    const char *eq = strchr(arg, '=');
+    size_t len = strlen(name);
+
+    if (strncmp(arg, "--gc-", 5) != 0 || !eq)
+        return false;
+
+    for (const char *c = arg + 5; c < eq && len < sizeof(name) - 1; c++)
+        name[len++] = (*c == '-') ? '_' : toupper((unsigned char)*c);
+    name[len] = '\0';
+
+    return setenv(name, eq + 1, 1) == 0;
+}
+
 static void repl(void)
 {
 
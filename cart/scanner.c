@@ -256,6 +256,20 @@ static int id_type(void)
             case 'i':
                 return check_keyword(2, 2, "le", TOKEN_FILE);
             }
+    case 'g':
+        if (scan.current - scan.start > 3)
+            switch (scan.start[3])
+            {
+            case 't':
+                return check_keyword(1, 6, "c_trim", TOKEN_GC_TRIM);
+            case 's':
+                return check_keyword(1, 7, "c_stats", TOKEN_GC_STATS);
+            case 'p':
+                return check_keyword(1, 9, "c_profile", TOKEN_GC_PROFILE);
+            }
+        break;
+    case 'h':
+        return check_keyword(1, 8, "eap_dump", TOKEN_HEAP_DUMP);
     case 'i':
         if (scan.current - scan.start > 1)
             switch (scan.start[1])
@@ -361,6 +375,8 @@ static int id_type(void)
             case 'h':
                 return check_keyword(2, 2, "is", TOKEN_THIS);
             case 'r':
+                if (scan.current - scan.start > 2 && scan.start[2] == 'a')
+                    return check_keyword(3, 7, "ce_dump", TOKEN_TRACE_DUMP);
                 return check_keyword(2, 2, "ue", TOKEN_TRUE);
             }
     case 'T':
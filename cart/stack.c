@@ -72,4 +72,5 @@ void push(Stack **s, Element e)
 
     st->count++;
     (st->top++)->as = e;
+    WRITE_BARRIER(STK(st));
 }
@@ -0,0 +1,500 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+
+/**
+    ykes_heap reads a dump written by heap_dump() or SIGUSR1 and reports
+    how many bytes each type and each root keeps alive.
+
+    An object's retained size is everything that would be freed with it:
+    the bytes of its subtree in the dominator tree of the object graph.
+    A root whose object is also reachable another way retains nothing on
+    its own and is reported as shared.
+*/
+
+#define HEAP_DUMP_VERSION 1
+#define KIND_MAX 256
+#define NAME_MAX_LEN 256
+
+typedef struct
+{
+    uint64_t id;
+    uint8_t kind;
+    uint64_t bytes;
+    uint32_t ref_start;
+    uint32_t ref_count;
+} Object;
+
+typedef struct
+{
+    char name[NAME_MAX_LEN];
+    uint64_t id;
+} Root;
+
+typedef struct
+{
+    const char *name;
+    size_t count;
+    uint64_t shallow;
+    uint64_t retained;
+} Summary;
+
+static Object *objects;
+static size_t object_count;
+static size_t object_cap;
+
+static uint64_t *refs;
+static size_t ref_count;
+static size_t ref_cap;
+
+static Root *roots;
+static size_t root_count;
+static size_t root_cap;
+
+static char kinds[KIND_MAX][NAME_MAX_LEN];
+static uint32_t kind_count;
+
+static int64_t *slots;
+static size_t slot_cap;
+
+static void *grow(void *items, size_t *cap, size_t size)
+{
+    *cap = *cap ? *cap * 2 : 64;
+    items = realloc(items, *cap * size);
+
+    if (!items)
+    {
+        perror("Failed to allocate heap graph");
+        exit(1);
+    }
+    return items;
+}
+
+static void read_bytes(FILE *in, void *dst, size_t len)
+{
+    if (fread(dst, 1, len, in) != len)
+    {
+        fprintf(stderr, "Truncated heap dump.\n");
+        exit(1);
+    }
+}
+
+static uint8_t read_u8(FILE *in)
+{
+    uint8_t v;
+    read_bytes(in, &v, sizeof(v));
+    return v;
+}
+
+static uint32_t read_u32(FILE *in)
+{
+    uint32_t v;
+    read_bytes(in, &v, sizeof(v));
+    return v;
+}
+
+static uint64_t read_u64(FILE *in)
+{
+    uint64_t v;
+    read_bytes(in, &v, sizeof(v));
+    return v;
+}
+
+static void read_name(FILE *in, char *dst)
+{
+    uint8_t len = read_u8(in);
+    read_bytes(in, dst, len);
+    dst[len] = '\0';
+}
+
+static void read_dump(FILE *in)
+{
+    char magic[4];
+    read_bytes(in, magic, sizeof(magic));
+
+    if (memcmp(magic, "YKHD", 4) != 0)
+    {
+        fprintf(stderr, "Not a ykes heap dump.\n");
+        exit(1);
+    }
+
+    uint32_t version = read_u32(in);
+    if (version != HEAP_DUMP_VERSION)
+    {
+        fprintf(stderr, "Unsupported heap dump version %u.\n", version);
+        exit(1);
+    }
+
+    kind_count = read_u32(in);
+    if (kind_count > KIND_MAX)
+    {
+        fprintf(stderr, "Corrupt heap dump.\n");
+        exit(1);
+    }
+
+    for (uint32_t i = 0; i < kind_count; i++)
+        read_name(in, kinds[i]);
+
+    for (;;)
+        switch (read_u8(in))
+        {
+        case 'R':
+            if (root_count + 1 > root_cap)
+                roots = grow(roots, &root_cap, sizeof(Root));
+            read_name(in, roots[root_count].name);
+            roots[root_count++].id = read_u64(in);
+            break;
+        case 'O':
+        {
+            if (object_count + 1 > object_cap)
+                objects = grow(objects, &object_cap, sizeof(Object));
+
+            Object *o = &objects[object_count++];
+            o->id = read_u64(in);
+            o->kind = read_u8(in);
+            o->bytes = read_u64(in);
+            o->ref_count = read_u32(in);
+            o->ref_start = (uint32_t)ref_count;
+
+            for (uint32_t i = 0; i < o->ref_count; i++)
+            {
+                if (ref_count + 1 > ref_cap)
+                    refs = grow(refs, &ref_cap, sizeof(uint64_t));
+                refs[ref_count++] = read_u64(in);
+            }
+            break;
+        }
+        case 'E':
+            return;
+        default:
+            fprintf(stderr, "Corrupt heap dump.\n");
+            exit(1);
+        }
+}
+
+static size_t hash_id(uint64_t id)
+{
+    id ^= id >> 33;
+    id *= 0xff51afd7ed558ccdULL;
+    id ^= id >> 33;
+    return (size_t)id;
+}
+
+static void index_objects(void)
+{
+    slot_cap = 64;
+    while (slot_cap < object_count * 2)
+        slot_cap *= 2;
+
+    if (!(slots = malloc(slot_cap * sizeof(int64_t))))
+    {
+        perror("Failed to allocate heap graph");
+        exit(1);
+    }
+    memset(slots, 0xff, slot_cap * sizeof(int64_t));
+
+    for (size_t i = 0; i < object_count; i++)
+    {
+        size_t h = hash_id(objects[i].id) & (slot_cap - 1);
+
+        while (slots[h] >= 0)
+            h = (h + 1) & (slot_cap - 1);
+        slots[h] = (int64_t)i;
+    }
+}
+
+/* node index of an id, objects start at 1 since 0 is the super root */
+static int64_t node_of(uint64_t id)
+{
+    for (size_t h = hash_id(id) & (slot_cap - 1); slots[h] >= 0; h = (h + 1) & (slot_cap - 1))
+        if (objects[slots[h]].id == id)
+            return slots[h] + 1;
+    return -1;
+}
+
+static size_t node_refs(size_t node, int64_t **out)
+{
+    static int64_t *buf;
+    static size_t cap;
+    size_t n = 0;
+
+    if (node == 0)
+    {
+        for (size_t i = 0; i < root_count; i++)
+        {
+            if (n + 1 > cap)
+                buf = grow(buf, &cap, sizeof(int64_t));
+            buf[n++] = node_of(roots[i].id);
+        }
+    }
+    else
+    {
+        Object *o = &objects[node - 1];
+
+        for (uint32_t i = 0; i < o->ref_count; i++)
+        {
+            if (n + 1 > cap)
+                buf = grow(buf, &cap, sizeof(int64_t));
+            buf[n++] = node_of(refs[o->ref_start + i]);
+        }
+    }
+
+    *out = buf;
+    return n;
+}
+
+static size_t *order;
+static size_t *rpo;
+static size_t *idom;
+static size_t **preds;
+static size_t *pred_count;
+static size_t *pred_cap;
+static uint64_t *retained;
+
+static void add_pred(size_t node, size_t pred)
+{
+    if (pred_count[node] + 1 > pred_cap[node])
+        preds[node] = grow(preds[node], &pred_cap[node], sizeof(size_t));
+    preds[node][pred_count[node]++] = pred;
+}
+
+/* reverse postorder from the super root, iteratively */
+static size_t number_nodes(size_t nodes)
+{
+    size_t *stack = malloc(nodes * sizeof(size_t));
+    size_t *next = calloc(nodes, sizeof(size_t));
+    char *seen = calloc(nodes, 1);
+    size_t top = 0;
+    size_t post = 0;
+
+    if (!stack || !next || !seen)
+    {
+        perror("Failed to allocate heap graph");
+        exit(1);
+    }
+
+    stack[top++] = 0;
+    seen[0] = 1;
+
+    while (top)
+    {
+        size_t node = stack[top - 1];
+        int64_t *out = NULL;
+        size_t n = node_refs(node, &out);
+
+        if (next[node] < n)
+        {
+            int64_t child = out[next[node]++];
+
+            if (child < 0)
+                continue;
+
+            add_pred((size_t)child, node);
+            if (!seen[child])
+            {
+                seen[child] = 1;
+                stack[top++] = (size_t)child;
+            }
+            continue;
+        }
+
+        order[post++] = node;
+        top--;
+    }
+
+    for (size_t i = 0; i < post; i++)
+        rpo[order[i]] = post - 1 - i;
+
+    free(stack);
+    free(next);
+    free(seen);
+    return post;
+}
+
+static size_t intersect(size_t a, size_t b)
+{
+    while (a != b)
+    {
+        while (rpo[a] > rpo[b])
+            a = idom[a];
+        while (rpo[b] > rpo[a])
+            b = idom[b];
+    }
+    return a;
+}
+
+static void dominators(size_t nodes)
+{
+    order = malloc(nodes * sizeof(size_t));
+    rpo = malloc(nodes * sizeof(size_t));
+    idom = malloc(nodes * sizeof(size_t));
+    preds = calloc(nodes, sizeof(size_t *));
+    pred_count = calloc(nodes, sizeof(size_t));
+    pred_cap = calloc(nodes, sizeof(size_t));
+    retained = calloc(nodes, sizeof(uint64_t));
+
+    if (!order || !rpo || !idom || !preds || !pred_count || !pred_cap || !retained)
+    {
+        perror("Failed to allocate heap graph");
+        exit(1);
+    }
+
+    size_t reached = number_nodes(nodes);
+    size_t undefined = nodes;
+
+    for (size_t i = 0; i < nodes; i++)
+        idom[i] = undefined;
+    idom[0] = 0;
+
+    for (bool changed = true; changed;)
+    {
+        changed = false;
+
+        for (size_t i = reached - 1; i-- > 0;)
+        {
+            size_t node = order[i];
+            size_t dom = undefined;
+
+            for (size_t p = 0; p < pred_count[node]; p++)
+            {
+                size_t pred = preds[node][p];
+
+                if (idom[pred] == undefined)
+                    continue;
+                dom = (dom == undefined) ? pred : intersect(pred, dom);
+            }
+
+            if (dom != idom[node])
+            {
+                idom[node] = dom;
+                changed = true;
+            }
+        }
+    }
+
+    /* postorder visits every node before its dominator */
+    for (size_t i = 0; i < reached; i++)
+    {
+        size_t node = order[i];
+
+        if (node)
+            retained[node] += objects[node - 1].bytes;
+        if (node != idom[node])
+            retained[idom[node]] += retained[node];
+    }
+}
+
+static int by_retained(const void *a, const void *b)
+{
+    const Summary *x = a;
+    const Summary *y = b;
+    return (x->retained < y->retained) - (x->retained > y->retained);
+}
+
+static void report_types(size_t nodes)
+{
+    Summary summary[KIND_MAX];
+    memset(summary, 0, sizeof(summary));
+
+    for (uint32_t i = 0; i < kind_count; i++)
+        summary[i].name = kinds[i];
+
+    for (size_t node = 1; node < nodes; node++)
+    {
+        Object *o = &objects[node - 1];
+
+        if (idom[node] == nodes)
+            continue;
+
+        summary[o->kind].count++;
+        summary[o->kind].shallow += o->bytes;
+
+        /* only the outermost object of a type counts its subtree */
+        size_t up = idom[node];
+        while (up && objects[up - 1].kind != o->kind)
+            up = idom[up];
+
+        if (!up)
+            summary[o->kind].retained += retained[node];
+    }
+
+    qsort(summary, kind_count, sizeof(Summary), by_retained);
+
+    printf("%-12s %10s %14s %14s\n", "type", "count", "shallow", "retained");
+    for (uint32_t i = 0; i < kind_count; i++)
+        if (summary[i].count)
+            printf("%-12s %10zu %14llu %14llu\n", summary[i].name, summary[i].count,
+                   (unsigned long long)summary[i].shallow,
+                   (unsigned long long)summary[i].retained);
+}
+
+static void report_roots(size_t nodes)
+{
+    Summary *summary = calloc(root_count + 1, sizeof(Summary));
+
+    if (!summary)
+    {
+        perror("Failed to allocate heap graph");
+        exit(1);
+    }
+
+    for (size_t i = 0; i < root_count; i++)
+    {
+        int64_t node = node_of(roots[i].id);
+
+        summary[i].name = roots[i].name;
+        if (node < 0 || idom[node] == nodes)
+            continue;
+
+        summary[i].shallow = objects[node - 1].bytes;
+        summary[i].count = idom[node] != 0;
+        summary[i].retained = summary[i].count ? 0 : retained[node];
+    }
+
+    qsort(summary, root_count, sizeof(Summary), by_retained);
+
+    printf("\n%-32s %14s %14s\n", "root", "shallow", "retained");
+    for (size_t i = 0; i < root_count; i++)
+    {
+        if (summary[i].count)
+            printf("%-32s %14llu %14s\n", summary[i].name,
+                   (unsigned long long)summary[i].shallow, "shared");
+        else
+            printf("%-32s %14llu %14llu\n", summary[i].name,
+                   (unsigned long long)summary[i].shallow,
+                   (unsigned long long)summary[i].retained);
+    }
+
+    free(summary);
+}
+
+int main(int argc, char **argv)
+{
+    if (argc != 2)
+    {
+        fprintf(stderr, "Usage: %s <file.heap>\n", argv[0]);
+        exit(1);
+    }
+
+    FILE *in = fopen(argv[1], "rb");
+    if (!in)
+    {
+        perror("Failed to open heap dump");
+        exit(1);
+    }
+
+    read_dump(in);
+    fclose(in);
+
+    size_t nodes = object_count + 1;
+    index_objects();
+    dominators(nodes);
+
+    printf("%zu objects, %llu bytes live\n\n", object_count,
+           (unsigned long long)retained[0]);
+    report_types(nodes);
+    report_roots(nodes);
+    return 0;
+}
@@ -0,0 +1,109 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+
+/**
+    ykes_trace prints a ring dumped by trace_dump(), --trace or a
+    crash, one event a line, oldest first, then a count of each kind.
+    The layout of an event must match TraceEvent in arena_memory.h.
+*/
+
+#define TRACE_VERSION 1
+
+typedef struct
+{
+    uint64_t a;
+    uint64_t b;
+    uint32_t seq;
+    uint32_t kind;
+} TraceEvent;
+
+static const char *kinds[] = {
+    "alloc", "free", "gc-begin", "gc-end", "call", "native", "return"};
+
+#define KIND_COUNT (sizeof(kinds) / sizeof(kinds[0]))
+
+static void read_bytes(FILE *in, void *dst, size_t len)
+{
+    if (fread(dst, 1, len, in) != len)
+    {
+        fprintf(stderr, "Truncated trace.\n");
+        exit(1);
+    }
+}
+
+static const char *pass_name(uint64_t pass)
+{
+    return pass == 1 ? "minor" : "major";
+}
+
+static void print_event(TraceEvent *e)
+{
+    const char *kind = e->kind < KIND_COUNT ? kinds[e->kind] : "?";
+
+    printf("%10u %-8s ", e->seq, kind);
+
+    switch (e->kind)
+    {
+    case 0:
+    case 1:
+        printf("%#llx %llu bytes\n", (unsigned long long)e->a, (unsigned long long)e->b);
+        break;
+    case 2:
+    case 3:
+        printf("%s %llu bytes live\n", pass_name(e->a), (unsigned long long)e->b);
+        break;
+    default:
+        printf("%#llx depth %llu\n", (unsigned long long)e->a, (unsigned long long)e->b);
+        break;
+    }
+}
+
+int main(int argc, char **argv)
+{
+    if (argc != 2)
+    {
+        fprintf(stderr, "Usage: %s <file.trace>\n", argv[0]);
+        exit(1);
+    }
+
+    FILE *in = fopen(argv[1], "rb");
+    if (!in)
+    {
+        perror("Failed to open trace");
+        exit(1);
+    }
+
+    char magic[4];
+    uint32_t head[2];
+    uint64_t count;
+
+    read_bytes(in, magic, sizeof(magic));
+    read_bytes(in, head, sizeof(head));
+    read_bytes(in, &count, sizeof(count));
+
+    if (memcmp(magic, "YKTR", 4) != 0 || head[0] != TRACE_VERSION || head[1] != sizeof(TraceEvent))
+    {
+        fprintf(stderr, "Not a ykes trace of this version.\n");
+        exit(1);
+    }
+
+    size_t totals[KIND_COUNT] = {0};
+
+    for (uint64_t i = 0; i < count; i++)
+    {
+        TraceEvent e;
+        read_bytes(in, &e, sizeof(e));
+        print_event(&e);
+
+        if (e.kind < KIND_COUNT)
+            totals[e.kind]++;
+    }
+    fclose(in);
+
+    printf("\n");
+    for (size_t i = 0; i < KIND_COUNT; i++)
+        printf("%-8s %zu\n", kinds[i], totals[i]);
+    return 0;
+}
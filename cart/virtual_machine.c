@@ -5,24 +5,28 @@
 #include <time.h>
 #include <stdio.h>
 #include <math.h>
+#include <sys/mman.h>
+
+static void reserve_frames(void);
+static void release_frames(void);
 
 void initVM(void)
 {
 
     initialize_global_memory();
 
-    machine.stack = NULL;
     machine.call_stack = NULL;
     machine.class_stack = NULL;
     machine.native_calls = NULL;
     machine.glob = NULL;
 
     machine.collect = false;
+    machine.gc_request = GC_NONE;
+    machine.dump_request = 0;
 
     machine.bytes_allocated = 0;
-    machine.next_gc = 900 * 900;
 
-    machine.stack = GROW_STACK(NULL, STACK_SIZE);
+    reserve_frames();
     machine.call_stack = GROW_STACK(NULL, STACK_SIZE);
     machine.class_stack = GROW_STACK(NULL, STACK_SIZE);
     machine.native_calls = GROW_STACK(NULL, STACK_SIZE);
@@ -48,30 +52,158 @@ void initVM(void)
     define_native(native_name("prime"), prime_native);
     define_native(native_name("file"), file_native);
     define_native(native_name("strstr"), strstr_native);
+    define_native(native_name("gc_trim"), gc_trim_native);
+    define_native(native_name("gc_stats"), gc_stats_native);
+    define_native(native_name("gc_profile"), gc_profile_native);
+    define_native(native_name("heap_dump"), heap_dump_native);
+    define_native(native_name("trace_dump"), trace_dump_native);
 }
 void freeVM(void)
 {
     FREE_TABLE(machine.glob);
-    FREE_STACK(&machine.stack);
+    release_frames();
     FREE_STACK(&machine.call_stack);
     FREE_STACK(&machine.class_stack);
     FREE_STACK(&machine.native_calls);
 
     machine.glob = NULL;
-    machine.stack = NULL;
     machine.call_stack = NULL;
     machine.class_stack = NULL;
     machine.native_calls = NULL;
 
+    if (machine.stats)
+        print_gc_stats();
+    if (machine.profile)
+        print_profile();
+
     destroy_global_memory();
 }
 
 static void reset_vm_stack(void)
 {
-    reset_stack(machine.stack);
+    machine.stack_top = machine.stack;
     machine.frame_count = 0;
 }
 
+/**
+    The call frames and the value stack are each one reservation of
+    address space, mapped PROT_NONE up front and committed a PAGE at
+    a time off the end, so neither ever moves: frame slots and open
+    upvalues keep pointing at the same Elements for the life of the
+    vm. Each reservation ends in a GUARD page that is never
+    committed, so running off the end faults rather than writing
+    into whatever is mapped next.
+
+    A call frame is promised FRAME_SLOTS of room when it is pushed,
+    so run() pushes and pops through its own stack pointer without
+    checking. The value stack starts one PAGE in, that page taking
+    the script frame's slot -1.
+*/
+static char *frames_base;
+static char *values_base;
+
+static char *reserve_region(size_t size)
+{
+    char *ptr = mmap(
+        NULL,
+        size + GUARD,
+        PROT_NONE,
+        MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE,
+        -1, 0);
+
+    if (ptr == MAP_FAILED)
+    {
+        perror("Failed to reserve the vm stack");
+        exit(1);
+    }
+    return ptr;
+}
+
+static void commit_region(char *from, char *to)
+{
+    if (mprotect(from, (size_t)(to - from), PROT_READ | PROT_WRITE))
+    {
+        perror("Failed to commit the vm stack");
+        exit(1);
+    }
+}
+
+static char *page_up(char *base, void *ptr)
+{
+    size_t off = (size_t)((char *)ptr - base);
+    return base + (off + PAGE - 1) / PAGE * PAGE;
+}
+
+static void reserve_frames(void)
+{
+    frames_base = reserve_region(FRAMES_RESERVE);
+    values_base = reserve_region(STACK_RESERVE);
+
+    machine.frames = (CallFrame *)frames_base;
+    char *end = page_up(frames_base, machine.frames + FRAMES_MAX);
+    commit_region(frames_base, end);
+    machine.frame_cap = (int)((size_t)(end - frames_base) / sizeof(CallFrame));
+
+    machine.stack = (Element *)(values_base + PAGE);
+    machine.stack_top = machine.stack;
+    end = page_up(values_base, machine.stack + FRAME_SLOTS * 2);
+    commit_region(values_base, end);
+    machine.stack_end = (Element *)end;
+
+    machine.stack[-1] = null_obj();
+}
+
+static void release_frames(void)
+{
+    munmap(frames_base, FRAMES_RESERVE + GUARD);
+    munmap(values_base, STACK_RESERVE + GUARD);
+    frames_base = values_base = NULL;
+
+    machine.frames = NULL;
+    machine.frame_cap = 0;
+    machine.stack = NULL;
+    machine.stack_top = NULL;
+    machine.stack_end = NULL;
+}
+
+/* commits room for one more frame and its FRAME_SLOTS, false once a reservation is spent */
+static bool reserve_call(void)
+{
+    if (machine.frame_count == machine.frame_cap)
+    {
+        char *from = (char *)(machine.frames + machine.frame_cap);
+        char *to = page_up(frames_base, machine.frames + machine.frame_cap + 1);
+
+        if (to > frames_base + FRAMES_RESERVE)
+            return false;
+
+        commit_region(from, to);
+        machine.frame_cap = (int)((size_t)(to - frames_base) / sizeof(CallFrame));
+    }
+
+    if (machine.stack_end - machine.stack_top < FRAME_SLOTS)
+    {
+        char *from = (char *)machine.stack_end;
+        char *to = page_up(values_base, machine.stack_top + FRAME_SLOTS);
+
+        if (to > values_base + STACK_RESERVE)
+            return false;
+
+        commit_region(from, to);
+        machine.stack_end = (Element *)to;
+    }
+    return true;
+}
+
+bool in_stack_guard(void *ptr)
+{
+    char *p = ptr;
+
+    if (frames_base && p >= frames_base + FRAMES_RESERVE && p < frames_base + FRAMES_RESERVE + GUARD)
+        return true;
+    return values_base && p >= values_base + STACK_RESERVE && p < values_base + STACK_RESERVE + GUARD;
+}
+
 static void runtime_error(const char *format, ...)
 {
     va_list args;
@@ -85,12 +217,13 @@ static void runtime_error(const char *format, ...)
 
         CallFrame *frame = &machine.frames[i];
         Function *func = frame->closure->func;
-        int line = frame->closure->func->ch.lines.listof.Ints[i];
+        size_t at = frame->ip > frame->ip_start ? (size_t)(frame->ip - frame->ip_start) - 1 : 0;
+        int line = func->ch.lines.listof.Ints[at];
 
-        if (!func->name.as.String)
+        if (!STR(func->name))
             fprintf(stderr, "script\n");
         else
-            fprintf(stderr, "%s()\n", func->name.as.String);
+            fprintf(stderr, "%s()\n", STR(func->name));
         fprintf(stderr, "[line %d] in script\n", line);
     }
 
@@ -103,12 +236,12 @@ static void define_native(Arena ar, NativeFn n)
     push(&machine.native_calls, el);
 }
 
-static inline Element prime_native(int argc, Stack *args)
+static inline Element prime_native(int argc, Element *args)
 {
-    return OBJ(_prime(args->as.arena));
+    return OBJ(_prime(args->arena));
 }
 
-static inline Element clock_native(int argc, Stack *args)
+static inline Element clock_native(int argc, Element *args)
 {
     return OBJ(Double((double)clock() / CLOCKS_PER_SEC));
 }
@@ -199,54 +332,110 @@ static void write_file(const char *path, const char *data)
     f = NULL;
 }
 
-static inline Element file_native(int argc, Stack *argv)
+static inline Element file_native(int argc, Element *argv)
 {
-    switch (*argv->as.arena.as.String)
+    switch (*STR(argv->arena))
     {
     case 'r':
-        return OBJ(CString(get_file(argv[1].as.arena.as.String)));
+        return OBJ(CString(get_file(STR(argv[1].arena))));
     case 'w':
-        write_file(argv[1].as.arena.as.String, argv[2].as.arena.as.String);
+        write_file(STR(argv[1].arena), STR(argv[2].arena));
         return null_obj();
     case 'a':
-        append_file(argv[1].as.arena.as.String, argv[2].as.arena.as.String);
+        append_file(STR(argv[1].arena), STR(argv[2].arena));
         return null_obj();
     default:
         return null_obj();
     }
 }
 
-static inline Element strstr_native(int argc, Stack *argv)
+static inline Element strstr_native(int argc, Element *argv)
 {
 
-    char *value = strstr(argv->as.arena.as.String, argv[1].as.arena.as.String);
+    argv->arena = spill_string(argv->arena);
+    char *value = strstr(argv->arena.as.String, STR(argv[1].arena));
 
-    char *append = value + strlen(argv[1].as.arena.as.String);
-    Arena replacement = argv[2].as.arena;
+    char *append = value + strlen(STR(argv[1].arena));
+    Arena replacement = argv[2].arena;
 
     size_t val_size = strlen(value);
-    size_t rep_size = strlen(replacement.as.String);
-    size_t og_size = strlen(argv->as.arena.as.String);
+    size_t rep_size = strlen(STR(replacement));
+    size_t og_size = strlen(argv->arena.as.String);
 
-    argv->as.arena.as.String[og_size - val_size] = '\0';
+    argv->arena.as.String[og_size - val_size] = '\0';
 
     char *res = NULL;
 
     res = ALLOC(og_size - val_size + rep_size + strlen(append));
 
-    strcpy(res, argv->as.arena.as.String);
+    strcpy(res, argv->arena.as.String);
 
-    strcat(res, replacement.as.String);
+    strcat(res, STR(replacement));
     strcat(res, append);
 
-    FREE(PTR(argv->as.arena.as.String));
-    argv->as.arena.as.String = res;
+    FREE(PTR(argv->arena.as.String));
+    argv->arena.as.String = res;
     return OBJ(CString(res));
 }
 
-static inline Element square_native(int argc, Stack *argv)
+static inline Element square_native(int argc, Element *argv)
 {
-    return OBJ(_sqr(argv->as.arena));
+    return OBJ(_sqr(argv->arena));
+}
+
+static inline Element gc_trim_native(int argc, Element *argv)
+{
+    gc_trim();
+    return null_obj();
+}
+
+static inline Element gc_profile_native(int argc, Element *argv)
+{
+    print_profile();
+    return null_obj();
+}
+
+static inline Element heap_dump_native(int argc, Element *argv)
+{
+    if (argc < 1 || argv->type != ARENA || !STR(argv->arena))
+        return null_obj();
+    return OBJ(Bool(heap_dump(STR(argv->arena))));
+}
+
+static inline Element trace_dump_native(int argc, Element *argv)
+{
+    if (argc < 1 || argv->type != ARENA || !STR(argv->arena))
+        return null_obj();
+    return OBJ(Bool(trace_dump(STR(argv->arena))));
+}
+
+static inline Element gc_stats_native(int argc, Element *argv)
+{
+    GcStats s = gc_stats();
+    Table *t = GROW_TABLE(NULL, TABLE_SIZE);
+
+    write_table(t, CString("minors"), OBJ(Long(s.minors)));
+    write_table(t, CString("majors"), OBJ(Long(s.majors)));
+    write_table(t, CString("pauses"), OBJ(Long(s.pauses)));
+    write_table(t, CString("last_pause"), OBJ(Double(s.last_pause)));
+    write_table(t, CString("max_pause"), OBJ(Double(s.max_pause)));
+    write_table(t, CString("total_pause"), OBJ(Double(s.total_pause)));
+    write_table(t, CString("last_marked"), OBJ(Long(s.last_marked)));
+    write_table(t, CString("marked"), OBJ(Long(s.marked)));
+    write_table(t, CString("freed"), OBJ(Long(s.freed)));
+    write_table(t, CString("compactions"), OBJ(Long(s.compactions)));
+    write_table(t, CString("moved"), OBJ(Long(s.moved)));
+    write_table(t, CString("heap_size"), OBJ(Long(s.heap_size)));
+    write_table(t, CString("heap_limit"), OBJ(Long(s.heap_limit)));
+    write_table(t, CString("allocated"), OBJ(Long(s.bytes_allocated)));
+    write_table(t, CString("next_gc"), OBJ(Long(s.next_gc)));
+    write_table(t, CString("survival"), OBJ(Double(s.survival)));
+    write_table(t, CString("free_bytes"), OBJ(Long(s.free_bytes)));
+    write_table(t, CString("free_blocks"), OBJ(Long(s.free_blocks)));
+    write_table(t, CString("largest_free"), OBJ(Long(s.largest_free)));
+    write_table(t, CString("fragmentation"), OBJ(Double(s.fragmentation)));
+
+    return TABLE(t);
 }
 
 static bool call(Closure *c, uint8_t argc)
@@ -258,7 +447,7 @@ static bool call(Closure *c, uint8_t argc)
         return false;
     }
 
-    if (machine.frame_count == FRAMES_MAX)
+    if (!reserve_call())
     {
         runtime_error("ERROR: Stack overflow.");
         return false;
@@ -269,10 +458,24 @@ static bool call(Closure *c, uint8_t argc)
     frame->closure->upvals = c->upvals;
     frame->ip = c->func->ch.op_codes.listof.Shorts;
     frame->ip_start = c->func->ch.op_codes.listof.Shorts;
-    frame->slots = machine.stack->top - argc - 1;
+    frame->slots = machine.stack_top - argc - 1;
+
+    TRACE(TRACE_CALL, c->func, machine.frame_count);
     return true;
 }
 
+/* collects, then fails the run if the heap limit could not be met */
+static bool safepoint(void)
+{
+    collect_garbage();
+
+    if (!heap_exhausted())
+        return true;
+
+    runtime_error("ERROR: Heap limit of %zu bytes reached.", gc_stats().heap_limit);
+    return false;
+}
+
 Interpretation interpret(const char *src)
 {
 
@@ -284,8 +487,8 @@ Interpretation interpret(const char *src)
     Closure *clos = new_closure(func);
     call(clos, 0);
 
-    push(&machine.stack, CLOSURE(clos));
-    close_upvalues(machine.stack->top - 1);
+    *machine.stack_top++ = CLOSURE(clos);
+    close_upvalues(machine.stack_top - 1);
     Interpretation res = run();
     return res;
 }
@@ -298,15 +501,11 @@ Interpretation interpret_path(const char *src, const char *path, const char *nam
         return INTERPRET_RUNTIME_ERR;
 
     Closure *clos = new_closure(func);
-
-    PTR(clos)->mark = true;
     call(clos, 0);
 
-    push(&machine.stack, closure(clos));
+    *machine.stack_top++ = closure(clos);
 
-    PTR(machine.stack)->mark = true;
-
-    close_upvalues(machine.stack->top - 1);
+    close_upvalues(machine.stack_top - 1);
 
     machine.collect = true;
     Interpretation res = run();
@@ -325,9 +524,10 @@ static bool call_value(Element el, uint8_t argc)
         return call(el.closure, argc);
     case NATIVE:
     {
-        Element res = el.native->fn(argc, machine.stack->top - argc);
-        (machine.stack - 1)->count -= (argc + 1);
-        machine.stack->top -= (argc + 1);
+        TRACE(TRACE_NATIVE, el.native, machine.frame_count);
+
+        Element res = el.native->fn(argc, machine.stack_top - argc);
+        machine.stack_top -= (argc + 1);
 
         if (res.type == ARENA)
         {
@@ -336,20 +536,23 @@ static bool call_value(Element el, uint8_t argc)
             else
                 machine.r1 = res.arena;
         }
-        // machine.stack->top[-1].as = res;
-        push(&machine.stack, res);
+        else if (res.type != NULL_OBJ)
+            machine.e2 = res;
+        // machine.stack_top[-1] = res;
+        *machine.stack_top++ = res;
         // machine.e2 = null_obj();
         return true;
     }
     case CLASS:
         machine.e4 = INSTANCE(instance(el.classc));
         machine.e4.instance->fields = GROW_TABLE(NULL, TABLE_SIZE);
-        machine.stack->top[-1 - argc].as = machine.e4;
+        WRITE_BARRIER(machine.e4);
+        machine.stack_top[-1 - argc] = machine.e4;
         return true;
     // case INSTANCE:
     // return true;
-    //     machine.stack->top[-1 - argc].as = el;
-    //     machine.stack->top[-1 - argc].as = el;
+    //     machine.stack_top[-1 - argc] = el;
+    //     machine.stack_top[-1 - argc] = el;
     //     machine.e4 = el;
     default:
         break;
@@ -358,7 +561,7 @@ static bool call_value(Element el, uint8_t argc)
     return false;
 }
 
-static Upval *capture_upvalue(Stack *s)
+static Upval *capture_upvalue(Element *s)
 {
     Upval *prev = NULL;
     Upval *curr = machine.open_upvals;
@@ -379,13 +582,14 @@ static Upval *capture_upvalue(Stack *s)
     return new;
 }
 
-static void close_upvalues(Stack *local)
+static void close_upvalues(Element *local)
 {
     while (machine.open_upvals && machine.open_upvals->index >= local)
     {
         Upval *up = machine.open_upvals;
         up->closed = *machine.open_upvals->index;
         up->index = &up->closed;
+        WRITE_BARRIER(UPVAL(up));
         machine.open_upvals = up->next;
     }
 }
@@ -442,7 +646,7 @@ static bool not_null(Element el)
         case ARENA_VAR:
         case ARENA_NATIVE:
         case ARENA_FUNC:
-            return ar.as.String ? true : false;
+            return (ar.small || ar.as.String) ? true : false;
         case ARENA_BYTES:
             return ar.listof.Bytes ? true : false;
         case ARENA_INTS:
@@ -478,54 +682,53 @@ static bool not_null(Element el)
     }
 }
 
-static Element pop_val(Stack *s)
-{
-
-    --s->count;
-    return (--s->top)->as;
-}
-
-static Element pop_machine(void)
-{
-    --machine.stack->count;
-    --machine.stack->count;
-    return (--machine.stack->top)->as;
-}
-
 Interpretation run(void)
 {
 
     CallFrame *frame = &machine.frames[machine.frame_count - 1];
+    Element *sp = machine.stack_top;
 
 #define READ_BYTE() (*frame->ip++)
 #define READ_CONSTANT() \
     ((frame->closure->func->ch.constants + READ_BYTE())->as)
 
-#define PEEK() ((machine.stack->top - 1)->as)
-#define NPEEK(N) ((machine.stack->top + (-1 - N))->as)
+#define PEEK() (sp[-1])
+#define NPEEK(N) (sp[-1 - (N)])
 #define FALSEY() (!machine.r5.as.Bool)
-#define POPN(n) (popn(&machine.stack, n))
-#define LOCAL() ((frame->slots + READ_BYTE())->as)
+#define POPN(n) (sp -= (n))
+#define LOCAL() (frame->slots[READ_BYTE()])
 #define JUMP() (*(frame->closure->func->ch.cases.listof.Ints + READ_BYTE()))
-#define PUSH(ar) (push(&machine.stack, ar))
+#define PUSH(ar)              \
+    do                        \
+    {                         \
+        Element pushed = (ar); \
+        *sp++ = pushed;       \
+    } while (0)
 #define CPUSH(ar) (push(&machine.call_stack, ar))
 #define PPUSH(ar) (push(&machine.class_stack, ar))
 #define FIND_GLOB(ar) (find(machine.glob, ar))
 #define WRITE_GLOB(a, b) (write_table(machine.glob, a, b))
 #define RM(ad) \
     free_asterisk(ad)
-#define POP() \
-    (--machine.stack->count, --machine.stack->count, (--machine.stack->top)->as)
+#define POP() (*--sp)
+#define BINARY(fn) (sp -= 2, fn(sp[1].arena, sp[0].arena))
 
     for (;;)
     {
+        machine.stack_top = sp;
+        if ((machine.gc_request != GC_NONE || machine.dump_request) && !safepoint())
+            return INTERPRET_RUNTIME_ERR;
+
 #ifdef DEBUG_TRACE_EXECUTION
-        for (Stack *v = machine.stack; v < machine.stack->top; v++)
-            print_line(v->as);
+        for (Element *v = machine.stack; v < sp; v++)
+            print_line(*v);
         disassemble_instruction(&frame->closure->func->ch,
                                 (int)(frame->ip - frame->closure->func->ch.op_codes.listof.Shorts));
 #endif
 
+        if (machine.profile)
+            machine.op_ip = frame->ip;
+
         switch (READ_BYTE())
         {
         case OP_CONSTANT:
@@ -542,6 +745,7 @@ Interpretation run(void)
                     (READ_BYTE())
                         ? capture_upvalue(frame->slots + READ_BYTE())
                         : frame->closure->upvals[READ_BYTE()];
+            WRITE_BARRIER(e);
         }
         break;
         case OP_METHOD:
@@ -553,18 +757,29 @@ Interpretation run(void)
                     (READ_BYTE())
                         ? capture_upvalue(frame->slots + READ_BYTE())
                         : frame->closure->upvals[READ_BYTE()];
+            WRITE_BARRIER(e);
             break;
         }
 
         case OP_GET_UPVALUE:
-            PUSH((*frame->closure->upvals + READ_BYTE())->closed.as);
+        {
+            Upval *up = *frame->closure->upvals + READ_BYTE();
+
+            if (flatten_str(&up->closed))
+                WRITE_BARRIER(UPVAL(up));
+            PUSH(up->closed);
             break;
+        }
         case OP_SET_UPVALUE:
-            ((*frame->closure->upvals + READ_BYTE()))->closed = *(machine.stack->top - 1);
+        {
+            Upval *up = *frame->closure->upvals + READ_BYTE();
+            up->closed = sp[-1];
+            WRITE_BARRIER(UPVAL(up));
             break;
+        }
 
         case OP_NEG:
-            (--machine.stack->top)->as = OBJ(_neg((machine.stack->top++)->as.arena));
+            sp[-1] = OBJ(_neg(sp[-1].arena));
             break;
 
         case OP_INC_GLO:
@@ -573,6 +788,7 @@ Interpretation run(void)
             Element ar = OBJ(_inc(FIND_GLOB(key.arena).arena));
             WRITE_GLOB(key.arena, ar);
             machine.r1 = ar.arena;
+            PUSH(ar);
             break;
         }
         case OP_DEC_GLO:
@@ -581,13 +797,14 @@ Interpretation run(void)
             Element ar = OBJ(_dec(FIND_GLOB(key.arena).arena));
             WRITE_GLOB(key.arena, ar);
             machine.r1 = ar.arena;
+            PUSH(ar);
             break;
         }
         case OP_INC_LOC:
         {
             uint8_t index = READ_BYTE();
-            Element el = OBJ(_inc((frame->slots + index)->as.arena));
-            (frame->slots + index)->as = el;
+            Element el = OBJ(_inc(frame->slots[index].arena));
+            frame->slots[index] = el;
             machine.r1 = el.arena;
             PUSH(OBJ(machine.r1));
             break;
@@ -595,23 +812,23 @@ Interpretation run(void)
         case OP_DEC_LOC:
         {
             uint8_t index = READ_BYTE();
-            Element el = OBJ(_dec((frame->slots + index)->as.arena));
-            (frame->slots + index)->as = el;
+            Element el = OBJ(_dec(frame->slots[index].arena));
+            frame->slots[index] = el;
             machine.r1 = el.arena;
             PUSH(OBJ(machine.r1));
             break;
         }
         case OP_INC:
-            (--machine.stack->top)->as = OBJ(_inc((machine.stack->top++)->as.arena));
+            sp[-1] = OBJ(_inc(sp[-1].arena));
             break;
         case OP_DEC:
-            (--machine.stack->top)->as = OBJ(_dec((machine.stack->top++)->as.arena));
+            sp[-1] = OBJ(_dec(sp[-1].arena));
             break;
         case OP_POPN:
             POPN(READ_CONSTANT().arena.as.Int);
             break;
         case OP_POP:
-            POP();
+            POPN(1);
             break;
         case OP_ADD:
             machine.r1 = _add(machine.r1, machine.r2);
@@ -659,49 +876,49 @@ Interpretation run(void)
             machine.r5 = _and(machine.r1, machine.r2);
             break;
         case OP_ADD_LOCAL:
-            PUSH(OBJ((machine.r1 = _add(POP().arena, POP().arena))));
+            PUSH(OBJ((machine.r1 = BINARY(_add))));
             break;
         case OP_SUB_LOCAL:
-            PUSH(OBJ((machine.r1 = _sub(POP().arena, POP().arena))));
+            PUSH(OBJ((machine.r1 = BINARY(_sub))));
             break;
         case OP_MUL_LOCAL:
-            PUSH(OBJ((machine.r1 = _mul(POP().arena, POP().arena))));
+            PUSH(OBJ((machine.r1 = BINARY(_mul))));
             break;
         case OP_MOD_LOCAL:
-            PUSH(OBJ((machine.r1 = _mod(POP().arena, POP().arena))));
+            PUSH(OBJ((machine.r1 = BINARY(_mod))));
             break;
         case OP_DIV_LOCAL:
-            PUSH(OBJ((machine.r1 = _div(POP().arena, POP().arena))));
+            PUSH(OBJ((machine.r1 = BINARY(_div))));
             break;
         case OP_EQ_LOCAL:
-            PUSH(OBJ((machine.r5 = _eq(POP().arena, POP().arena))));
+            PUSH(OBJ((machine.r5 = BINARY(_eq))));
             break;
         case OP_NE_LOCAL:
-            PUSH(OBJ((machine.r5 = _ne(POP().arena, POP().arena))));
+            PUSH(OBJ((machine.r5 = BINARY(_ne))));
             break;
         case OP_SEQ_LOCAL:
-            PUSH(OBJ((machine.r5 = _seq(POP().arena, POP().arena))));
+            PUSH(OBJ((machine.r5 = BINARY(_seq))));
             break;
         case OP_SNE_LOCAL:
-            PUSH(OBJ((machine.r5 = _sne(POP().arena, POP().arena))));
+            PUSH(OBJ((machine.r5 = BINARY(_sne))));
             break;
         case OP_LT_LOCAL:
-            PUSH(OBJ((machine.r5 = _lt(POP().arena, POP().arena))));
+            PUSH(OBJ((machine.r5 = BINARY(_lt))));
             break;
         case OP_LE_LOCAL:
-            PUSH(OBJ((machine.r5 = _le(POP().arena, POP().arena))));
+            PUSH(OBJ((machine.r5 = BINARY(_le))));
             break;
         case OP_GT_LOCAL:
-            PUSH(OBJ((machine.r5 = _gt(POP().arena, POP().arena))));
+            PUSH(OBJ((machine.r5 = BINARY(_gt))));
             break;
         case OP_GE_LOCAL:
-            PUSH(OBJ((machine.r5 = _ge(POP().arena, POP().arena))));
+            PUSH(OBJ((machine.r5 = BINARY(_ge))));
             break;
         case OP_OR_LOCAL:
-            PUSH(OBJ((machine.r5 = _or(POP().arena, POP().arena))));
+            PUSH(OBJ((machine.r5 = BINARY(_or))));
             break;
         case OP_AND_LOCAL:
-            PUSH(OBJ((machine.r5 = _and(POP().arena, POP().arena))));
+            PUSH(OBJ((machine.r5 = BINARY(_and))));
             break;
 
         case OP_GET_GLOB_ACCESS:
@@ -733,7 +950,8 @@ Interpretation run(void)
         case OP_GET_LOCAL_ACCESS:
         {
 
-            Element el = _get_access(POP().arena, PEEK());
+            Arena index = POP().arena;
+            Element el = _get_access(index, PEEK());
 
             if (el.type == NULL_OBJ)
                 return INTERPRET_RUNTIME_ERR;
@@ -745,18 +963,19 @@ Interpretation run(void)
             else
                 machine.r1 = el.arena;
 
-            PUSH(el);
+            sp[-1] = el;
 
             break;
         }
         case OP_SET_LOCAL_ACCESS:
-
+        {
             if (machine.e1.type == NULL_OBJ)
                 machine.e1 = OBJ(machine.r1);
 
-            _set_access(POP(), PEEK().arena, machine.e3);
-            // PUSH(machine.e3);
+            Element val = POP();
+            _set_access(val, POP().arena, machine.e3);
             break;
+        }
         case OP_RESET_ARGC:
             machine.cargc = 0;
             machine.argc = 0;
@@ -789,12 +1008,13 @@ Interpretation run(void)
         case OP_PUSH_LOCAL_ARRAY_VAL:
         {
 
-            Element res = _push_array_val(POP(), PEEK());
+            Element val = POP();
+            Element res = _push_array_val(val, PEEK());
 
             if (res.type != NULL_OBJ)
             {
                 machine.e1 = res;
-                PUSH(res);
+                sp[-1] = res;
                 break;
             }
             return INTERPRET_RUNTIME_ERR;
@@ -822,6 +1042,9 @@ Interpretation run(void)
         case OP_CPY_ARRAY:
             machine.e1 = cpy_array(machine.e1);
             break;
+        case OP_CPY_R1:
+            machine.r1 = cpy_array(OBJ(machine.r1)).arena;
+            break;
 
         case OP_REVERSE_GLOB_ARRAY:
 
@@ -843,7 +1066,7 @@ Interpretation run(void)
             machine.r1 = search_arena(machine.r1, machine.r4);
             break;
         case OP_BIN_SEARCH_LOCAL_ARRAY:
-            PUSH(OBJ(search_arena(POP().arena, POP().arena)));
+            PUSH(OBJ(BINARY(search_arena)));
             break;
 
         case OP_LEN:
@@ -910,6 +1133,8 @@ Interpretation run(void)
 
             Element n = find_entry(&machine.e4.instance->fields, &name);
 
+            if (flatten_str(&n))
+                write_table(machine.e4.instance->fields, name, n);
             if (n.type != ARENA)
                 machine.e1 = n, machine.e2 = n;
 
@@ -918,7 +1143,7 @@ Interpretation run(void)
             if (n.type != NULL_OBJ)
                 break;
 
-            runtime_error("ERROR: Undefined field '%s'.", name.as.String);
+            runtime_error("ERROR: Undefined field '%s'.", STR(name));
             return INTERPRET_RUNTIME_ERR;
         }
         case OP_GET_METHOD:
@@ -942,15 +1167,17 @@ Interpretation run(void)
             if (n.type != NULL_OBJ)
                 break;
 
-            runtime_error("ERROR: Undefined method '%s'.", name.as.String);
+            runtime_error("ERROR: Undefined method '%s'.", STR(name));
             return INTERPRET_RUNTIME_ERR;
         }
         break;
         case OP_CALL:
         {
             uint8_t argc = READ_BYTE();
+            machine.stack_top = sp;
             if (!call_value(machine.e2, argc))
                 return INTERPRET_RUNTIME_ERR;
+            sp = machine.stack_top;
 
             frame = (machine.frames + (machine.frame_count - 1));
             machine.argc = (argc == 0) ? 1 : argc;
@@ -961,8 +1188,10 @@ Interpretation run(void)
         case OP_CALL_LOCAL:
         {
             uint8_t argc = READ_BYTE();
+            machine.stack_top = sp;
             if (!call_value(NPEEK(argc), argc))
                 return INTERPRET_RUNTIME_ERR;
+            sp = machine.stack_top;
 
             machine.e2 = null_obj();
             frame = (machine.frames + (machine.frame_count - 1));
@@ -1014,12 +1243,15 @@ Interpretation run(void)
             frame->ip -= READ_BYTE();
             break;
         case OP_CLOSE_UPVAL:
-            close_upvalues(machine.stack->top - 1);
+            close_upvalues(sp - 1);
             break;
         case OP_GET_LOCAL:
         {
 
-            Element el = LOCAL();
+            Element *slot = &LOCAL();
+            flatten_str(slot);
+
+            Element el = *slot;
             PUSH(el);
 
             if (el.type == INSTANCE)
@@ -1039,8 +1271,8 @@ Interpretation run(void)
 
             uint16_t index = READ_BYTE();
 
-            frame->slots[index].as = (machine.cargc < machine.argc)
-                                         ? (frame->slots + machine.cargc++)->as
+            frame->slots[index] = (machine.cargc < machine.argc)
+                                         ? frame->slots[machine.cargc++]
                                          : PEEK();
             break;
         }
@@ -1060,6 +1292,7 @@ Interpretation run(void)
         {
             Element el = INSTANCE(instance((machine.class_stack + READ_BYTE())->as.classc));
             el.instance->fields = GROW_TABLE(NULL, NATIVE_STACK_SIZE);
+            WRITE_BARRIER(el);
             machine.e4 = el;
             break;
         }
@@ -1105,9 +1338,11 @@ Interpretation run(void)
 
             if (el.type == NULL_OBJ)
             {
-                runtime_error("ERROR: Undefined global value '%s'.", var.as.String);
+                runtime_error("ERROR: Undefined global value '%s'.", STR(var));
                 return INTERPRET_RUNTIME_ERR;
             }
+            if (flatten_str(&el))
+                WRITE_GLOB(var, el);
 
             if (call_param)
                 PUSH(el);
@@ -1145,7 +1380,7 @@ Interpretation run(void)
         {
             Element el = READ_CONSTANT();
             Element res = (machine.cargc < machine.argc)
-                              ? (frame->slots + machine.cargc++)->as
+                              ? frame->slots[machine.cargc++]
                               : POP();
 
             if (res.type == CLOSURE)
@@ -1352,18 +1587,17 @@ Interpretation run(void)
         case OP_RETURN:
         {
             Element el = POP();
+            TRACE(TRACE_RETURN, frame->closure->func, machine.frame_count);
             --machine.frame_count;
 
             if (machine.frame_count == 0)
             {
-                POP();
+                POPN(1);
+                machine.stack_top = sp;
                 return INTERPRET_SUCCESS;
             }
 
-            for (Stack *s = machine.stack; s < machine.stack->top; s++)
-                POP();
-
-            machine.stack->top = frame->slots;
+            sp = frame->slots;
 
             if (el.type == ARENA)
             {
@@ -1384,7 +1618,7 @@ Interpretation run(void)
     }
 
 #undef RM
-#undef POP
+#undef BINARY
 #undef WRITE_GLOB
 #undef FIND_GLOB
 #undef PPUSH